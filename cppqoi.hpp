@@ -28,15 +28,70 @@
 #ifndef CPPQOI_HPP_INCLUDED
 #define CPPQOI_HPP_INCLUDED
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <random>
+#include <set>
 #include <string>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <filesystem>
 
 #include <iostream>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(CPPQOI_NO_DISPATCH)
+#define CPPQOI_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<coroutine>) && __has_include(<span>) && defined(__cpp_impl_coroutine)
+#define CPPQOI_COROUTINES 1
+#include <coroutine>
+#include <span>
+#endif
+#endif
+
+#if defined(__linux__) && defined(__has_include) && !defined(CPPQOI_NO_IO_URING)
+#if __has_include(<linux/io_uring.h>)
+#define CPPQOI_IO_URING 1
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(CPPQOI_NO_MMAP)
+#define CPPQOI_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace cppqoi
 {
 
@@ -50,6 +105,8 @@ constexpr unsigned char CPPQOI_OP_RUN = 0b11000000; /// Tag for the Run QOI oper
 constexpr uint32_t CPPQOI_HEADER_SIZE = 14; /// Size of the QOI file header
 constexpr std::array<uint8_t, 8> CPPQOI_ENDTAG {0, 0, 0, 0, 0, 0, 0, 1}; /// QOI's endtag, marks the end of a  QOI file.
 constexpr std::array<uint8_t, 4> CPPQOI_MAGIC {'q', 'o', 'i', 'f'}; /// QOI's magic, identifying a QOI file
+constexpr std::array<uint8_t, 4> CPPQOI_CHECKSUM_TAG {'q', 'c', 'r', 'c'}; /// Tag of the optional CRC32C chunk after the end tag
+constexpr size_t CPPQOI_CHECKSUM_SIZE = 8; /// Checksum tag followed by the big-endian CRC32C of every byte before the chunk
 
 /**
   * @brief Represents an RGBA pixel.
@@ -62,7 +119,7 @@ public:
       * @brief Default constructor.
       * Initializes r=0, g=0, b=0, a=255
       */
-    Rgba() {}
+    constexpr Rgba() {}
 
     /**
       * @brief Constructor.
@@ -71,13 +128,13 @@ public:
       * @param db Blue value of the pixel.
       * @param da Alpha value of the pixel.
       */
-    Rgba(uint8_t dr, uint8_t dg, uint8_t db, uint8_t da) : r(dr), g(dg), b(db), a(da) {}
+    constexpr Rgba(uint8_t dr, uint8_t dg, uint8_t db, uint8_t da) : r(dr), g(dg), b(db), a(da) {}
 
     /**
       * @brief Tests if two pixels are equal.
       * @return True if equal, false otherwise.
       */
-    bool operator==(const Rgba& o)
+    constexpr bool operator==(const Rgba& o) const
     {
         return r == o.r && g == o.g && b == o.b && a == o.a;
     }
@@ -101,11 +158,382 @@ struct QoiFile
     uint8_t colorspace; ///colorspace, 0 = sRGB, 1 = linear
 };
 
+/**
+  * @brief Trade-off between encode speed and file size of lossless encoding.
+  */
+enum class QoiPreset : uint8_t
+{
+    Balanced, /// searches every QOI op for the smallest encoding of each pixel
+    Fastest /// only emits RUN, DIFF and RGB(A) ops from a branch-reduced kernel, files grow somewhat
+};
+
+/**
+  * @brief Instruction set level of the vectorized kernels (CRC32C, opaque scan, run fill), see SetKernelTier.
+  */
+enum class QoiKernelTier : uint8_t
+{
+    Baseline, /// the ISA of the including target
+    Sse42, /// SSE4.2 crc32 instruction and 128 bit run fills
+    Avx2, /// 256 bit opaque scan and run fills
+    Avx512 /// 512 bit opaque scan
+};
+
+/**
+  * @brief Optional encoder behaviour for WriteQoi.
+  */
+struct QoiEncodeOptions
+{
+    QoiPreset preset{QoiPreset::Balanced}; /// speed preset of lossless encoding, ignored in near-lossless mode
+    bool detectOpaque{false}; /// scan 4 channel input and write it as a 3 channel file if every alpha is 255
+    std::array<uint8_t, 4> maxError{0, 0, 0, 0}; /// near-lossless mode, largest allowed error of r, g, b and a. All 0 is lossless
+    bool checksum{false}; /// append a CRC32C chunk after the end tag, decoders that do not know it ignore it
+};
+
+/**
+  * @brief Order of the pixels in decoded pixelData.
+  * The tiled layouts split the image into square tiles of tileSize pixels, stored one after another
+  * in row-major order. Width and height are rounded up to whole tiles, the padding pixels are zero.
+  */
+enum class QoiLayout : uint8_t
+{
+    Linear, /// row-major, the pixel at (x, y) is pixel y * width + x
+    Tiled, /// row-major tiles, row-major pixels within each tile
+    Morton /// row-major tiles, Z-order pixels within each tile (x in the even bits, y in the odd bits of the index)
+};
+
+/**
+  * @brief Optional decoder behaviour for LoadQoi.
+  */
+struct QoiDecodeOptions
+{
+    uint8_t channels{0}; /// channels of the decoded pixelData, 0 keeps the file's. 4 expands RGB files to RGBA with alpha 255
+    bool verifyChecksum{false}; /// fail unless the file carries a CRC32C chunk matching its contents
+    QoiLayout layout{QoiLayout::Linear}; /// pixel order of pixelData, applies to LoadQoi and LoadQoiParallel
+    uint32_t tileSize{8}; /// edge length of the tiles of the tiled layouts, a power of two up to 256
+};
+
 constexpr uint32_t HashPixel(const Rgba& pix)
 {
     return (pix.r * 3 + pix.g * 5 + pix.b * 7 + pix.a * 11);
 }
 
+namespace Detail
+{
+
+/**
+  * @brief Lookup tables of the slicing-by-8 CRC32C (Castagnoli) software path.
+  */
+struct Crc32cTables
+{
+    constexpr Crc32cTables()
+    {
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for(int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+            table[0][i] = crc;
+        }
+        for(uint32_t i = 0; i < 256; i++)
+            for(int t = 1; t < 8; t++)
+                table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+    }
+
+    uint32_t table[8][256]{};
+};
+
+/**
+  * @brief CRC32C for the ISA of the including target, the crc32 instruction if it has SSE4.2, otherwise a slicing-by-8 table.
+  */
+inline uint32_t Crc32cBaseline(uint32_t crc, const uint8_t* data, size_t size)
+{
+    crc = ~crc;
+    size_t i = 0;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    for(; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        crc = static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+    }
+    for(; i < size; i++)
+        crc = _mm_crc32_u8(crc, data[i]);
+#else
+    static constexpr Crc32cTables tables;
+    const auto& t = tables.table;
+    for(; i + 8 <= size; i += 8)
+    {
+        uint32_t low = crc ^ (data[i] | data[i + 1] << 8 | data[i + 2] << 16 | static_cast<uint32_t>(data[i + 3]) << 24);
+        crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+              t[3][data[i + 4]] ^ t[2][data[i + 5]] ^ t[1][data[i + 6]] ^ t[0][data[i + 7]];
+    }
+    for(; i < size; i++)
+        crc = (crc >> 8) ^ t[0][(crc ^ data[i]) & 0xff];
+#endif
+    return ~crc;
+}
+
+/**
+  * @brief Tail of every IsOpaque kernel, checks two pixels per 64 bit word from pixel i on.
+  */
+inline bool IsOpaqueTail(const uint8_t* rgba, size_t i, size_t pixelCount)
+{
+    const uint8_t alphaBytes[8] = {0, 0, 0, 0xff, 0, 0, 0, 0xff};
+    uint64_t alphaMask;
+    std::memcpy(&alphaMask, alphaBytes, sizeof(alphaMask));
+    for(; i + 2 <= pixelCount; i += 2)
+    {
+        uint64_t word;
+        std::memcpy(&word, rgba + i * 4, sizeof(word));
+        if((word & alphaMask) != alphaMask)
+            return false;
+    }
+    return i == pixelCount || rgba[i * 4 + 3] == 255;
+}
+
+inline bool IsOpaqueBaseline(const uint8_t* rgba, size_t pixelCount)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    //or in 0xff for the color bytes so a fully set vector means every alpha was 255
+    const __m128i colorMask = _mm_set1_epi32(0x00ffffff);
+    const __m128i ones = _mm_set1_epi32(-1);
+    for(; i + 16 <= pixelCount; i += 16)
+    {
+        const __m128i* block = reinterpret_cast<const __m128i*>(rgba + i * 4);
+        __m128i v = _mm_and_si128(_mm_and_si128(_mm_loadu_si128(block), _mm_loadu_si128(block + 1)),
+                                  _mm_and_si128(_mm_loadu_si128(block + 2), _mm_loadu_si128(block + 3)));
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(v, colorMask), ones)) != 0xffff)
+            return false;
+    }
+#endif
+    return IsOpaqueTail(rgba, i, pixelCount);
+}
+
+/**
+  * @brief Writes count copies of pixel with Channels bytes each, the pixels of a RUN op.
+  * @return The output position after the written pixels.
+  */
+template<uint8_t Channels>
+constexpr uint8_t* FillRun(uint8_t* out, const Rgba& pixel, size_t count)
+{
+    for(size_t k = 0; k < count; k++, out += Channels)
+    {
+        out[0] = pixel.r;
+        out[1] = pixel.g;
+        out[2] = pixel.b;
+        if(Channels == 4)
+            out[3] = pixel.a;
+    }
+    return out;
+}
+
+#if defined(CPPQOI_DISPATCH)
+//kernels for ISA extensions the including target may not have, only called once cpuid reported them
+
+__attribute__((target("sse4.2"))) inline uint32_t Crc32cSse42(uint32_t crc, const uint8_t* data, size_t size)
+{
+    crc = ~crc;
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        crc = static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+    }
+    for(; i < size; i++)
+        crc = _mm_crc32_u8(crc, data[i]);
+    return ~crc;
+}
+
+__attribute__((target("avx2"))) inline bool IsOpaqueAvx2(const uint8_t* rgba, size_t pixelCount)
+{
+    size_t i = 0;
+    const __m256i colorMask = _mm256_set1_epi32(0x00ffffff);
+    const __m256i ones = _mm256_set1_epi32(-1);
+    for(; i + 32 <= pixelCount; i += 32)
+    {
+        const __m256i* block = reinterpret_cast<const __m256i*>(rgba + i * 4);
+        __m256i v = _mm256_and_si256(_mm256_and_si256(_mm256_loadu_si256(block), _mm256_loadu_si256(block + 1)),
+                                     _mm256_and_si256(_mm256_loadu_si256(block + 2), _mm256_loadu_si256(block + 3)));
+        if(!_mm256_testc_si256(_mm256_or_si256(v, colorMask), ones))
+            return false;
+    }
+    return IsOpaqueTail(rgba, i, pixelCount);
+}
+
+__attribute__((target("avx512f"))) inline bool IsOpaqueAvx512(const uint8_t* rgba, size_t pixelCount)
+{
+    size_t i = 0;
+    const __m512i alphaMask = _mm512_set1_epi32(static_cast<int>(0xff000000));
+    for(; i + 64 <= pixelCount; i += 64)
+    {
+        const __m512i* block = reinterpret_cast<const __m512i*>(rgba + i * 4);
+        __m512i v = _mm512_and_si512(_mm512_and_si512(_mm512_loadu_si512(block), _mm512_loadu_si512(block + 1)),
+                                     _mm512_and_si512(_mm512_loadu_si512(block + 2), _mm512_loadu_si512(block + 3)));
+        if(_mm512_cmpneq_epi32_mask(_mm512_and_si512(v, alphaMask), alphaMask) != 0)
+            return false;
+    }
+    return IsOpaqueTail(rgba, i, pixelCount);
+}
+
+/**
+  * @brief Fills 3 byte pixels with overlapping 16 byte stores of a 5 pixel pattern, 4 pixels apart.
+  */
+__attribute__((target("sse4.2"))) inline uint8_t* FillRun3Sse42(uint8_t* out, const Rgba& pixel, size_t count)
+{
+    const __m128i pattern = _mm_setr_epi8(pixel.r, pixel.g, pixel.b, pixel.r, pixel.g, pixel.b, pixel.r, pixel.g,
+                                          pixel.b, pixel.r, pixel.g, pixel.b, pixel.r, pixel.g, pixel.b, pixel.r);
+    //every store stays within the run, it ends at least 6 pixels before its end
+    for(; count >= 6; count -= 4, out += 12)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), pattern);
+    return FillRun<3>(out, pixel, count);
+}
+
+__attribute__((target("sse4.2"))) inline uint8_t* FillRun4Sse42(uint8_t* out, const Rgba& pixel, size_t count)
+{
+    uint32_t value = pixel.r | pixel.g << 8 | pixel.b << 16 | static_cast<uint32_t>(pixel.a) << 24;
+    const __m128i pattern = _mm_set1_epi32(static_cast<int>(value));
+    for(; count >= 4; count -= 4, out += 16)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), pattern);
+    return FillRun<4>(out, pixel, count);
+}
+
+__attribute__((target("avx2"))) inline uint8_t* FillRun3Avx2(uint8_t* out, const Rgba& pixel, size_t count)
+{
+    //32 byte stores of a 10 pixel pattern (plus 2 bytes), 8 pixels apart
+    alignas(32) uint8_t bytes[32];
+    for(int i = 0; i < 32; i++)
+        bytes[i] = i % 3 == 0 ? pixel.r : (i % 3 == 1 ? pixel.g : pixel.b);
+    const __m256i pattern = _mm256_load_si256(reinterpret_cast<const __m256i*>(bytes));
+    for(; count >= 11; count -= 8, out += 24)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), pattern);
+    return FillRun3Sse42(out, pixel, count);
+}
+
+__attribute__((target("avx2"))) inline uint8_t* FillRun4Avx2(uint8_t* out, const Rgba& pixel, size_t count)
+{
+    uint32_t value = pixel.r | pixel.g << 8 | pixel.b << 16 | static_cast<uint32_t>(pixel.a) << 24;
+    const __m256i pattern = _mm256_set1_epi32(static_cast<int>(value));
+    for(; count >= 8; count -= 8, out += 32)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), pattern);
+    return FillRun4Sse42(out, pixel, count);
+}
+#endif
+
+/**
+  * @brief Kernels of one QoiKernelTier, see Kernels.
+  */
+struct KernelTable
+{
+    QoiKernelTier tier;
+    uint32_t (*crc32c)(uint32_t crc, const uint8_t* data, size_t size);
+    bool (*isOpaque)(const uint8_t* rgba, size_t pixelCount);
+    uint8_t* (*fillRun3)(uint8_t* out, const Rgba& pixel, size_t count);
+    uint8_t* (*fillRun4)(uint8_t* out, const Rgba& pixel, size_t count);
+};
+
+/**
+  * @brief The kernels of tier, tiers are cumulative so every table falls back to the one below.
+  */
+inline const KernelTable& KernelTableFor(QoiKernelTier tier)
+{
+#if defined(CPPQOI_DISPATCH)
+    static constexpr KernelTable tables[] =
+    {
+        {QoiKernelTier::Baseline, Crc32cBaseline, IsOpaqueBaseline, FillRun<3>, FillRun<4>},
+        {QoiKernelTier::Sse42, Crc32cSse42, IsOpaqueBaseline, FillRun3Sse42, FillRun4Sse42},
+        {QoiKernelTier::Avx2, Crc32cSse42, IsOpaqueAvx2, FillRun3Avx2, FillRun4Avx2},
+        {QoiKernelTier::Avx512, Crc32cSse42, IsOpaqueAvx512, FillRun3Avx2, FillRun4Avx2},
+    };
+    return tables[static_cast<size_t>(tier)];
+#else
+    static constexpr KernelTable baseline{QoiKernelTier::Baseline, Crc32cBaseline, IsOpaqueBaseline, FillRun<3>, FillRun<4>};
+    (void)tier;
+    return baseline;
+#endif
+}
+
+/**
+  * @brief Highest tier the CPU supports, read with cpuid.
+  */
+inline QoiKernelTier DetectKernelTier(void)
+{
+#if defined(CPPQOI_DISPATCH)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2"))
+        return QoiKernelTier::Avx512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2"))
+        return QoiKernelTier::Avx2;
+    if(__builtin_cpu_supports("sse4.2"))
+        return QoiKernelTier::Sse42;
+#endif
+    return QoiKernelTier::Baseline;
+}
+
+/**
+  * @brief Tier selected on first use, the detected one unless CPPQOI_KERNEL_TIER names a lower one.
+  * CPPQOI_KERNEL_TIER is one of baseline, sse4.2, avx2 or avx512, higher tiers than the CPU supports are capped.
+  */
+inline QoiKernelTier InitialKernelTier(void)
+{
+    QoiKernelTier detected = DetectKernelTier();
+    const char* name = std::getenv("CPPQOI_KERNEL_TIER");
+    if(name == nullptr)
+        return detected;
+    const std::array<std::string, 4> names{"baseline", "sse4.2", "avx2", "avx512"};
+    for(size_t i = 0; i < names.size(); i++)
+        if(names[i] == name)
+            return std::min(static_cast<QoiKernelTier>(i), detected);
+    return detected;
+}
+
+inline std::atomic<const KernelTable*>& ActiveKernels(void)
+{
+    static std::atomic<const KernelTable*> active{&KernelTableFor(InitialKernelTier())};
+    return active;
+}
+
+/**
+  * @brief Kernels of the active tier, chosen from the CPU features on first use.
+  */
+inline const KernelTable& Kernels(void)
+{
+    return *ActiveKernels().load(std::memory_order_relaxed);
+}
+
+}
+
+/**
+  * @brief Tier of the kernels in use.
+  */
+inline QoiKernelTier GetKernelTier(void)
+{
+    return Detail::Kernels().tier;
+}
+
+/**
+  * @brief Highest tier this CPU and build support, Baseline where dispatch is not compiled in.
+  */
+inline QoiKernelTier GetMaxKernelTier(void)
+{
+    static const QoiKernelTier detected = Detail::DetectKernelTier();
+    return detected;
+}
+
+/**
+  * @brief Switches every following call to the kernels of tier, e.g. to compare tiers in a benchmark.
+  * Calls already running finish with the kernels they started with.
+  * @return False if the CPU does not support tier.
+  */
+inline bool SetKernelTier(QoiKernelTier tier)
+{
+    if(tier > GetMaxKernelTier())
+        return false;
+    Detail::ActiveKernels().store(&Detail::KernelTableFor(tier), std::memory_order_relaxed);
+    return true;
+}
+
 namespace Utility
 {
 
@@ -125,10 +553,10 @@ inline void Write32(std::vector<uint8_t>& mem, uint32_t value, size_t& position)
 
 inline void Write32(uint32_t value, std::ostream& stream)
 {
-    Write8((value >> 24) && 0xff, stream);
-    Write8((value >> 16) && 0xff, stream);
-    Write8((value >> 8) && 0xff, stream);
-    Write8(value && 0xff, stream);
+    Write8((value >> 24) & 0xff, stream);
+    Write8((value >> 16) & 0xff, stream);
+    Write8((value >> 8) & 0xff, stream);
+    Write8(value & 0xff, stream);
 }
 
 inline uint8_t Read8(std::istream& stream)
@@ -138,6 +566,14 @@ inline uint8_t Read8(std::istream& stream)
     return returnV;
 }
 
+inline uint32_t Read32(const uint8_t* mem, size_t& position)
+{
+    uint32_t value = static_cast<uint32_t>(mem[position]) << 24 | static_cast<uint32_t>(mem[position + 1]) << 16 |
+                     static_cast<uint32_t>(mem[position + 2]) << 8 | mem[position + 3];
+    position += 4;
+    return value;
+}
+
 inline uint32_t Read32(const std::vector<uint8_t>& mem, size_t& position)
 {
     unsigned w = mem[position];
@@ -159,375 +595,3636 @@ inline uint32_t Read32(std::istream& stream)
     return ( static_cast<unsigned>(w) << 24) + (static_cast<unsigned>(x) << 16) + (static_cast<unsigned>(y) << 8) + static_cast<unsigned>(z);
 }
 
+/**
+  * @brief Fast non-cryptographic 128 bit hash of a block of memory.
+  * Four independent 64 bit lanes consume 32 bytes per step, so the hash runs near memory bandwidth.
+  */
+inline std::array<uint64_t, 2> Hash128(const uint8_t* data, size_t size, uint64_t seed = 0)
+{
+    constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto round = [&](uint64_t lane, uint64_t input) { return rotl(lane + input * prime2, 31) * prime1; };
+    auto mix = [](uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDULL;
+        x ^= x >> 33;
+        x *= 0xC4CEB9FE1A85EC53ULL;
+        return x ^ (x >> 33);
+    };
+
+    std::array<uint64_t, 4> lanes {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+    size_t i = 0;
+    for(; i + 32 <= size; i += 32)
+        for(size_t l = 0; l < 4; l++)
+        {
+            uint64_t word;
+            std::memcpy(&word, data + i + l * 8, sizeof(word));
+            lanes[l] = round(lanes[l], word);
+        }
+
+    uint64_t tail[4] = {0, 0, 0, 0};
+    std::memcpy(tail, data + i, size - i);
+    for(size_t l = 0; l < 4; l++)
+        lanes[l] = round(lanes[l], tail[l] ^ size);
+
+    return {mix(lanes[0] ^ rotl(lanes[1], 17) ^ rotl(lanes[2], 29)), mix(lanes[3] ^ rotl(lanes[2], 7) ^ rotl(lanes[1], 41) ^ size)};
+}
+
+/**
+  * @brief Tests if every pixel of interleaved RGBA data has an alpha of 255.
+  */
+inline bool IsOpaque(const uint8_t* rgba, size_t pixelCount)
+{
+    return Detail::Kernels().isOpaque(rgba, pixelCount);
 }
 
-class QoiIStream
+/**
+  * @brief Continues the CRC32C of a byte sequence.
+  * Uses the SSE4.2 crc32 instruction when the CPU has it, otherwise a slicing-by-8 table.
+  * @param crc CRC32C of the bytes before data, 0 to start a new sequence.
+  * @return CRC32C of all bytes so far.
+  */
+inline uint32_t Crc32c(uint32_t crc, const uint8_t* data, size_t size)
 {
-public:
+    return Detail::Kernels().crc32c(crc, data, size);
+}
 
-    QoiIStream() { }
-    QoiIStream(std::shared_ptr<std::istream> str) { Create(str); }
-    QoiIStream(const std::string& str) { Open(str); }
+/**
+  * @brief Size of a QOI file without its checksum chunk, if it has one.
+  */
+inline size_t StripChecksum(const uint8_t* data, size_t size)
+{
+    if(size < CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size() + CPPQOI_CHECKSUM_SIZE)
+        return size;
+    const uint8_t* chunk = data + size - CPPQOI_CHECKSUM_SIZE;
+    if(!std::equal(CPPQOI_CHECKSUM_TAG.begin(), CPPQOI_CHECKSUM_TAG.end(), chunk) ||
+       !std::equal(CPPQOI_ENDTAG.begin(), CPPQOI_ENDTAG.end(), chunk - CPPQOI_ENDTAG.size()))
+        return size;
+    return size - CPPQOI_CHECKSUM_SIZE;
+}
 
-    bool Open(const std::string& filename)
-    {
-        std::shared_ptr<std::ifstream> file = std::make_shared<std::ifstream>(filename.c_str(), std::ifstream::in | std::ifstream::binary);
-        if(file == nullptr || !file->is_open())
-            return false;
-        return Create(file);
-    }
+}
 
-    bool Create(std::shared_ptr<std::istream> str)
+namespace Detail
+{
+
+/**
+  * @brief Running state of the QOI encoder, carried from one pixel to the next.
+  */
+struct EncoderState
+{
+    constexpr EncoderState()
     {
-        if(str == nullptr || !str->good())
-            return false;
-        bool success = LoadHeader(*str);
-        stream = success ? std::dynamic_pointer_cast<std::istream>(str) : nullptr;
+        for(Rgba& s : seen)
+            s = Rgba(0, 0, 0, 0);
+    }
 
-        for(uint32_t i = 0; i < seen.size(); i++)
-            seen[i] = Rgba();
-        pixel = Rgba(0, 0, 0, 255);
-        run = 0;
-        pixelIndex = 0;
+    std::array<Rgba, 64> seen; /// previously seen pixels, indexed by HashPixel, initially all zero
+    Rgba lastPixel{0, 0, 0, 255}; /// the previously encoded pixel
+    uint8_t run{0}; /// length of the run currently being built
+};
 
-        return success;
+/**
+  * @brief Encodes a single pixel.
+  * @tparam Alpha False if every pixel has an alpha of 255, drops all alpha work.
+  * @param state Encoder state, updated in place.
+  * @param pixel The pixel to encode.
+  * @param last True if this is the final pixel of the image, flushes any pending run.
+  * @param out Output position, at least 6 bytes must be writable, a pending RUN op followed by an RGBA op.
+  * @return The output position after the written bytes.
+  */
+template<bool Alpha = true>
+constexpr uint8_t* EncodePixel(EncoderState& state, const Rgba& pixel, bool last, uint8_t* out)
+{
+    Rgba& lastPixel = state.lastPixel;
+    if(Alpha ? lastPixel == pixel : (lastPixel.r == pixel.r && lastPixel.g == pixel.g && lastPixel.b == pixel.b))
+    {
+        state.run++;
+        if(state.run == 62 || last) //we are too far into a run or simply at the end of the file
+        {
+            *out++ = static_cast<uint8_t>(CPPQOI_OP_RUN | (state.run - 1));
+            state.run = 0;
+        }
+        return out;
     }
 
-    QoiIStream& operator>>(Rgba& pixel)
+    if(state.run > 0) //we encountered a different pixel during a run, end the run we had going
     {
-        pixel = Get();
-        return *this;
+        *out++ = static_cast<uint8_t>(CPPQOI_OP_RUN | (state.run - 1));
+        state.run = 0;
     }
 
-    Rgba Get(void)
+    uint8_t pixelHash = static_cast<uint8_t>(HashPixel(pixel) % 64);
+
+    if(state.seen[pixelHash] == pixel)
+        *out++ = CPPQOI_OP_INDEX | pixelHash;
+    else
     {
-        if(run)
-        {
-            run--;
-            pixelIndex++;
-            return pixel;
-        }
+        state.seen[pixelHash] = pixel;
 
-        uint8_t tag = Utility::Read8(*stream);
-        if(tag == CPPQOI_OP_RGB || tag == CPPQOI_OP_RGBA)
-        {
-            uint8_t r = Utility::Read8(*stream);
-            uint8_t g = Utility::Read8(*stream);
-            uint8_t b = Utility::Read8(*stream);
-            uint8_t a = (tag == CPPQOI_OP_RGBA) ? Utility::Read8(*stream) : pixel.a;
-            pixel = Rgba(r, g, b, a);
-        }
-        else
+        if(!Alpha || pixel.a == lastPixel.a)
         {
-            uint8_t tagOp = (tag & 0b11000000);
-            uint8_t tagOperand = (tag & 0b00111111);
-            if(tagOp == CPPQOI_OP_INDEX) // 00
-                pixel = seen[tagOperand];
-            else if(tagOp == CPPQOI_OP_DIFF) // 01
+            int8_t dr = static_cast<int8_t>(pixel.r - lastPixel.r);
+            int8_t dg = static_cast<int8_t>(pixel.g - lastPixel.g);
+            int8_t db = static_cast<int8_t>(pixel.b - lastPixel.b);
+
+            int8_t dgr = dr - dg;
+            int8_t dgb = db - dg;
+
+            if(dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
+                *out++ = CPPQOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+            else if(dgr > -9 && dgr < 8 && dg > -33 && dg < 32 && dgb > -9 && dgb < 8)
             {
-                pixel.r += static_cast<uint8_t>( (((tagOperand & 0b110000) >> 4U) & 0x3) - 2);
-                pixel.g += static_cast<uint8_t>( (((tagOperand & 0b001100) >> 2U) & 0x3) - 2);
-                pixel.b += static_cast<uint8_t>( (((tagOperand & 0b000011) >> 0U) & 0x3) - 2);
+                *out++ = CPPQOI_OP_LUMA | (dg + 32);
+                *out++ = (dgr + 8 ) << 4 | (dgb + 8);
             }
-            else if(tagOp == CPPQOI_OP_LUMA) // 10
+            else
             {
-                uint8_t l = Utility::Read8(*stream);
-                const uint8_t dg = static_cast<uint8_t>( static_cast<unsigned>(tagOperand) - 32);
-
-                pixel.r += (dg - 8 + static_cast<uint8_t>((l >> 4U)) && 0b00001111U);
-                pixel.g += dg;
-                pixel.b += (dg - 8 + static_cast<uint8_t>((l >> 0U)) && 0b00001111U);
+                *out++ = CPPQOI_OP_RGB;
+                *out++ = pixel.r;
+                *out++ = pixel.g;
+                *out++ = pixel.b;
             }
-            else if(tagOp == CPPQOI_OP_RUN) // 11
-                run = tagOperand;
         }
-        seen[HashPixel(pixel) % 64] = pixel;
-        pixelIndex++;
-        return pixel;
-    }
+        else
+        {
+            *out++ = CPPQOI_OP_RGBA;
+            *out++ = pixel.r;
+            *out++ = pixel.g;
+            *out++ = pixel.b;
+            *out++ = pixel.a;
+        }
+    }
+    lastPixel = pixel;
+    return out;
+}
+
+
+/**
+  * @brief Encodes count pixels of interleaved data.
+  * @tparam SrcChannels Channels of the source data, 3=RGB, 4=RGBA.
+  * @tparam Alpha False to ignore the source alpha, encoding every pixel with alpha 255.
+  * @param endsImage True if the last of these pixels is the last of the image.
+  * @param out Output position, at least 5 bytes per pixel plus one for a pending run must be writable.
+  * @return The output position after the written bytes.
+  */
+template<uint8_t SrcChannels, bool Alpha>
+constexpr uint8_t* EncodePixels(EncoderState& state, const uint8_t* src, size_t count, bool endsImage, uint8_t* out)
+{
+    Rgba pixel(0, 0, 0, 255);
+    for(size_t i = 0; i < count; i++, src += SrcChannels)
+    {
+        pixel.r = src[0];
+        pixel.g = src[1];
+        pixel.b = src[2];
+        if(Alpha && SrcChannels == 4)
+            pixel.a = src[3];
+        out = EncodePixel<Alpha>(state, pixel, endsImage && i == count - 1, out);
+    }
+    return out;
+}
+
+/**
+  * @brief Encodes a single pixel with the Fastest preset.
+  * Only RUN, DIFF and RGB(A) ops are emitted. The index is never consulted or updated, which is
+  * valid because decoders maintain their own, and all op bytes are stored unconditionally so only
+  * the output advance depends on the chosen op.
+  * @param out Output position, at least 6 bytes must be writable, a pending RUN op followed by the 5 stored op bytes.
+  */
+template<bool Alpha = true>
+constexpr uint8_t* EncodePixelFastest(EncoderState& state, const Rgba& pixel, bool last, uint8_t* out)
+{
+    Rgba& lastPixel = state.lastPixel;
+    if(Alpha ? lastPixel == pixel : (lastPixel.r == pixel.r && lastPixel.g == pixel.g && lastPixel.b == pixel.b))
+    {
+        state.run++;
+        if(state.run == 62 || last)
+        {
+            *out++ = static_cast<uint8_t>(CPPQOI_OP_RUN | (state.run - 1));
+            state.run = 0;
+        }
+        return out;
+    }
+
+    if(state.run > 0)
+    {
+        *out++ = static_cast<uint8_t>(CPPQOI_OP_RUN | (state.run - 1));
+        state.run = 0;
+    }
+
+    //biased differences, a channel fits DIFF exactly when its biased value is below 4
+    uint8_t dr = static_cast<uint8_t>(pixel.r - lastPixel.r + 2);
+    uint8_t dg = static_cast<uint8_t>(pixel.g - lastPixel.g + 2);
+    uint8_t db = static_cast<uint8_t>(pixel.b - lastPixel.b + 2);
+    bool sameAlpha = !Alpha || pixel.a == lastPixel.a;
+    bool diff = sameAlpha && (dr | dg | db) < 4;
+
+    out[0] = diff ? static_cast<uint8_t>(CPPQOI_OP_DIFF | dr << 4 | dg << 2 | db) : (sameAlpha ? CPPQOI_OP_RGB : CPPQOI_OP_RGBA);
+    out[1] = pixel.r;
+    out[2] = pixel.g;
+    out[3] = pixel.b;
+    out[4] = pixel.a;
+    out += diff ? 1 : (sameAlpha ? 4 : 5);
+
+    lastPixel = pixel;
+    return out;
+}
+
+/**
+  * @brief Fastest preset variant of EncodePixels, see EncodePixelFastest.
+  * @param out Output position, at least 5 bytes per pixel plus one for a pending run must be writable.
+  */
+template<uint8_t SrcChannels, bool Alpha>
+constexpr uint8_t* EncodePixelsFastest(EncoderState& state, const uint8_t* src, size_t count, bool endsImage, uint8_t* out)
+{
+    Rgba pixel(0, 0, 0, 255);
+    for(size_t i = 0; i < count; i++, src += SrcChannels)
+    {
+        pixel.r = src[0];
+        pixel.g = src[1];
+        pixel.b = src[2];
+        if(Alpha && SrcChannels == 4)
+            pixel.a = src[3];
+        out = EncodePixelFastest<Alpha>(state, pixel, endsImage && i == count - 1, out);
+    }
+    return out;
+}
+
+/**
+  * @brief Near-lossless variant of EncodePixels.
+  * Every pixel is replaced by the cheapest pixel within maxError of it that a RUN, INDEX, DIFF or LUMA
+  * op can reach from the decoder's state, falling back to RGB(A) ops. The state tracks the decoded
+  * pixels rather than the source, so errors never add up beyond maxError.
+  */
+template<uint8_t SrcChannels, bool Alpha>
+inline uint8_t* EncodePixelsNearLossless(EncoderState& state, const uint8_t* src, size_t count, bool endsImage, uint8_t* out, const std::array<uint8_t, 4>& maxError)
+{
+    auto close = [&](uint8_t a, uint8_t b, int channel)
+    {
+        return std::abs(static_cast<int>(a) - static_cast<int>(b)) <= maxError[channel];
+    };
+    auto within = [&](const Rgba& a, const Rgba& b)
+    {
+        return close(a.r, b.r, 0) && close(a.g, b.g, 1) && close(a.b, b.b, 2) && (!Alpha || close(a.a, b.a, 3));
+    };
+    auto clampDelta = [](int delta, int low, int high)
+    {
+        return delta < low ? low : (delta > high ? high : delta);
+    };
+
+    Rgba pixel(0, 0, 0, 255);
+    for(size_t i = 0; i < count; i++, src += SrcChannels)
+    {
+        pixel.r = src[0];
+        pixel.g = src[1];
+        pixel.b = src[2];
+        if(Alpha && SrcChannels == 4)
+            pixel.a = src[3];
+
+        Rgba& last = state.lastPixel;
+        if(within(pixel, last))
+        {
+            state.run++;
+            if(state.run == 62 || (endsImage && i == count - 1))
+            {
+                *out++ = static_cast<uint8_t>(CPPQOI_OP_RUN | (state.run - 1));
+                state.run = 0;
+            }
+            continue;
+        }
+
+        if(state.run > 0)
+        {
+            *out++ = static_cast<uint8_t>(CPPQOI_OP_RUN | (state.run - 1));
+            state.run = 0;
+        }
+
+        Rgba decoded = pixel;
+        uint8_t pixelHash = static_cast<uint8_t>(HashPixel(pixel) % 64);
+        int8_t dr = static_cast<int8_t>(pixel.r - last.r);
+        int8_t dg = static_cast<int8_t>(pixel.g - last.g);
+        int8_t db = static_cast<int8_t>(pixel.b - last.b);
+        bool alphaKept = !Alpha || close(pixel.a, last.a, 3);
+
+        int diffR = clampDelta(dr, -2, 1);
+        int diffG = clampDelta(dg, -2, 1);
+        int diffB = clampDelta(db, -2, 1);
+        Rgba diff = last;
+        diff.r += diffR;
+        diff.g += diffG;
+        diff.b += diffB;
+
+        int lumaG = clampDelta(dg, -32, 31);
+        int lumaR = clampDelta(dr - lumaG, -8, 7);
+        int lumaB = clampDelta(db - lumaG, -8, 7);
+        Rgba luma = last;
+        luma.r += lumaR + lumaG;
+        luma.g += lumaG;
+        luma.b += lumaB + lumaG;
+
+        int index = within(state.seen[pixelHash], pixel) ? pixelHash : -1;
+
+        if(index >= 0)
+        {
+            *out++ = CPPQOI_OP_INDEX | static_cast<uint8_t>(index);
+            decoded = state.seen[index];
+        }
+        else if(alphaKept && within(diff, pixel))
+        {
+            *out++ = CPPQOI_OP_DIFF | (diffR + 2) << 4 | (diffG + 2) << 2 | (diffB + 2);
+            decoded = diff;
+        }
+        else
+        {
+            //any other slot within reach still beats a LUMA op
+            for(int k = 0; k < 64 && index < 0; k++)
+                if(within(state.seen[k], pixel))
+                    index = k;
+
+            if(index >= 0)
+            {
+                *out++ = CPPQOI_OP_INDEX | static_cast<uint8_t>(index);
+                decoded = state.seen[index];
+            }
+            else if(alphaKept && within(luma, pixel))
+            {
+                *out++ = CPPQOI_OP_LUMA | (lumaG + 32);
+                *out++ = (lumaR + 8) << 4 | (lumaB + 8);
+                decoded = luma;
+            }
+            else if(alphaKept)
+            {
+                *out++ = CPPQOI_OP_RGB;
+                *out++ = pixel.r;
+                *out++ = pixel.g;
+                *out++ = pixel.b;
+                decoded.a = last.a;
+            }
+            else
+            {
+                *out++ = CPPQOI_OP_RGBA;
+                *out++ = pixel.r;
+                *out++ = pixel.g;
+                *out++ = pixel.b;
+                *out++ = pixel.a;
+            }
+        }
+
+        state.seen[HashPixel(decoded) % 64] = decoded;
+        last = decoded;
+    }
+    return out;
+}
+
+/**
+  * @brief Encodes count pixels with the kernel selected by options.
+  * @param srcChannels Channels of src, 3=RGB, 4=RGBA.
+  * @param alpha False to encode every pixel with alpha 255, required for 3 channel files.
+  * @param out Output position, at least 5 bytes per pixel plus one for a pending run must be writable.
+  * @return The output position after the written bytes.
+  */
+inline uint8_t* EncodeSpan(EncoderState& state, const QoiEncodeOptions& options, uint8_t srcChannels, bool alpha,
+                           const uint8_t* src, size_t count, bool endsImage, uint8_t* out)
+{
+    if(options.maxError != std::array<uint8_t, 4>{0, 0, 0, 0})
+    {
+        if(srcChannels == 3)
+            return EncodePixelsNearLossless<3, false>(state, src, count, endsImage, out, options.maxError);
+        if(!alpha)
+            return EncodePixelsNearLossless<4, false>(state, src, count, endsImage, out, options.maxError);
+        return EncodePixelsNearLossless<4, true>(state, src, count, endsImage, out, options.maxError);
+    }
+    if(options.preset == QoiPreset::Fastest)
+    {
+        if(srcChannels == 3)
+            return EncodePixelsFastest<3, false>(state, src, count, endsImage, out);
+        if(!alpha)
+            return EncodePixelsFastest<4, false>(state, src, count, endsImage, out);
+        return EncodePixelsFastest<4, true>(state, src, count, endsImage, out);
+    }
+    if(srcChannels == 3)
+        return EncodePixels<3, false>(state, src, count, endsImage, out);
+    if(!alpha)
+        return EncodePixels<4, false>(state, src, count, endsImage, out);
+    return EncodePixels<4, true>(state, src, count, endsImage, out);
+}
+
+/**
+  * @brief Pixels encoded or decoded between checksum updates, small enough that their bytes are still in cache.
+  */
+constexpr size_t CHECKSUM_BLOCK = 16 * 1024;
+
+/**
+  * @brief Writes the checksum chunk for crc.
+  * @return The output position after the chunk.
+  */
+inline uint8_t* WriteChecksum(uint32_t crc, uint8_t* out)
+{
+    for(unsigned char c : CPPQOI_CHECKSUM_TAG)
+        *out++ = c;
+    for(int shift = 24; shift >= 0; shift -= 8)
+        *out++ = static_cast<uint8_t>(crc >> shift);
+    return out;
+}
+
+/**
+  * @brief Running state of the QOI decoder, carried from one op to the next.
+  */
+struct DecoderState
+{
+    constexpr DecoderState()
+    {
+        for(Rgba& s : seen)
+            s = Rgba(0, 0, 0, 0);
+    }
+
+    std::array<Rgba, 64> seen; /// previously seen pixels, indexed by HashPixel, initially all zero
+    Rgba pixel{0, 0, 0, 255}; /// the most recently decoded pixel
+    uint32_t run{0}; /// repeats of pixel still owed by the last RUN op
+};
+
+/**
+  * @brief Number of bytes of the op starting with tag, including the tag itself.
+  */
+constexpr size_t OpSize(uint8_t tag)
+{
+    return tag == CPPQOI_OP_RGBA ? 5 : (tag == CPPQOI_OP_RGB ? 4 : ((tag & 0b11000000) == CPPQOI_OP_LUMA ? 2 : 1));
+}
+
+/**
+  * @brief Applies the single op at data to pixel and the index.
+  * A RUN op only sets state.run, the caller emits the run.
+  * @return The position after the op.
+  */
+constexpr const uint8_t* DecodeOp(DecoderState& state, Rgba& pixel, const uint8_t* data)
+{
+    uint8_t tag = *data++;
+    if(tag == CPPQOI_OP_RGB || tag == CPPQOI_OP_RGBA) //this is just flat loading the pixel
+    {
+        pixel.r = data[0];
+        pixel.g = data[1];
+        pixel.b = data[2];
+        if(tag == CPPQOI_OP_RGBA)
+            pixel.a = data[3];
+        data += (tag == CPPQOI_OP_RGBA) ? 4 : 3;
+    }
+    else
+    {
+        uint8_t tagOp = (tag & 0b11000000);
+        uint8_t tagOperand = (tag & 0b00111111);
+        if(tagOp == CPPQOI_OP_INDEX) // 00
+            pixel = state.seen[tagOperand];
+        else if(tagOp == CPPQOI_OP_DIFF) // 01
+        {
+            pixel.r += static_cast<uint8_t>( (((tagOperand & 0b110000) >> 4U) & 0x3) - 2);
+            pixel.g += static_cast<uint8_t>( (((tagOperand & 0b001100) >> 2U) & 0x3) - 2);
+            pixel.b += static_cast<uint8_t>( (((tagOperand & 0b000011) >> 0U) & 0x3) - 2);
+        }
+        else if(tagOp == CPPQOI_OP_LUMA) // 10
+        {
+            uint8_t l = *data++;
+            const uint8_t dg = static_cast<uint8_t>( static_cast<unsigned>(tagOperand) - 32);
+
+            pixel.r += static_cast<uint8_t>(dg - 8 + ((l >> 4U) & 0b00001111U));
+            pixel.g += dg;
+            pixel.b += static_cast<uint8_t>(dg - 8 + ((l >> 0U) & 0b00001111U));
+        }
+        else // 11, RUN
+            state.run = tagOperand;
+    }
+    state.seen[HashPixel(pixel) % 64] = pixel;
+    return data;
+}
+
+/**
+  * @brief Writes the pending run of state.pixel, at most until outEnd.
+  * @return The output position after the written pixels.
+  */
+template<uint8_t Channels>
+constexpr uint8_t* DecodeRun(DecoderState& state, const Rgba& pixel, uint8_t* out, uint8_t* outEnd)
+{
+    size_t repeat = std::min<size_t>(state.run, (outEnd - out) / Channels);
+    state.run -= static_cast<uint32_t>(repeat);
+#if defined(CPPQOI_DISPATCH)
+    //short runs are not worth the indirect call
+    if(!__builtin_is_constant_evaluated() && repeat >= 8)
+        return Channels == 4 ? Kernels().fillRun4(out, pixel, repeat) : Kernels().fillRun3(out, pixel, repeat);
+#endif
+    return FillRun<Channels>(out, pixel, repeat);
+}
+
+/**
+  * @brief Decodes count pixels.
+  * Once data reaches end the last pixel is repeated, like the reference decoder does.
+  * @tparam Channels Channels written per pixel to out, independent of the file's channels.
+  * @param data Op data to decode, ops may read up to 4 bytes past end so end must not be the end of the buffer.
+  * @param end End of the op data, normally the start of the end tag.
+  * @return The position in data after the consumed ops.
+  */
+template<uint8_t Channels>
+constexpr const uint8_t* DecodePixels(DecoderState& state, const uint8_t* data, const uint8_t* end, uint8_t* out, size_t count)
+{
+    Rgba pixel = state.pixel;
+    uint8_t* outEnd = out + count * Channels;
+
+    while(out < outEnd)
+    {
+        if(state.run > 0)
+        {
+            out = DecodeRun<Channels>(state, pixel, out, outEnd);
+            continue;
+        }
+
+        if(data < end)
+            data = DecodeOp(state, pixel, data);
+
+        out[0] = pixel.r;
+        out[1] = pixel.g;
+        out[2] = pixel.b;
+        if(Channels == 4)
+            out[3] = pixel.a;
+        out += Channels;
+    }
+
+    state.pixel = pixel;
+    return data;
+}
+
+/**
+  * @brief Decodes up to count pixels from the complete ops in [data, end).
+  * Unlike DecodePixels nothing at or past end is read, decoding stops early at an op that is
+  * cut off by end so it can be resumed once more data has arrived.
+  * @param written Receives the number of pixels written to out.
+  * @return The position in data after the consumed ops.
+  */
+template<uint8_t Channels>
+constexpr const uint8_t* DecodeAvailable(DecoderState& state, const uint8_t* data, const uint8_t* end, uint8_t* out, size_t count, size_t& written)
+{
+    Rgba pixel = state.pixel;
+    uint8_t* start = out;
+    uint8_t* outEnd = out + count * Channels;
+
+    while(out < outEnd)
+    {
+        if(state.run > 0)
+        {
+            out = DecodeRun<Channels>(state, pixel, out, outEnd);
+            continue;
+        }
+
+        if(end - data < 5 && (data == end || static_cast<size_t>(end - data) < OpSize(*data)))
+            break;
+        data = DecodeOp(state, pixel, data);
+
+        out[0] = pixel.r;
+        out[1] = pixel.g;
+        out[2] = pixel.b;
+        if(Channels == 4)
+            out[3] = pixel.a;
+        out += Channels;
+    }
+
+    state.pixel = pixel;
+    written = static_cast<size_t>(out - start) / Channels;
+    return data;
+}
+
+}
+
+class QoiIStream
+{
+public:
+
+    QoiIStream() { }
+    QoiIStream(std::shared_ptr<std::istream> str) { Create(str); }
+    QoiIStream(const std::string& str) { Open(str); }
+
+    bool Open(const std::string& filename)
+    {
+        std::shared_ptr<std::ifstream> file = std::make_shared<std::ifstream>(filename.c_str(), std::ifstream::in | std::ifstream::binary);
+        if(file == nullptr || !file->is_open())
+            return false;
+        return Create(file);
+    }
+
+    bool Create(std::shared_ptr<std::istream> str)
+    {
+        if(str == nullptr || !str->good())
+            return false;
+        bool success = LoadHeader(*str);
+        stream = success ? std::dynamic_pointer_cast<std::istream>(str) : nullptr;
+
+        seen.fill(Rgba(0, 0, 0, 0));
+        pixel = Rgba(0, 0, 0, 255);
+        run = 0;
+        pixelIndex = 0;
+
+        return success;
+    }
+
+    QoiIStream& operator>>(Rgba& pixel)
+    {
+        pixel = Get();
+        return *this;
+    }
+
+    Rgba Get(void)
+    {
+        if(run)
+        {
+            run--;
+            pixelIndex++;
+            return pixel;
+        }
+
+        uint8_t tag = Utility::Read8(*stream);
+        if(tag == CPPQOI_OP_RGB || tag == CPPQOI_OP_RGBA)
+        {
+            uint8_t r = Utility::Read8(*stream);
+            uint8_t g = Utility::Read8(*stream);
+            uint8_t b = Utility::Read8(*stream);
+            uint8_t a = (tag == CPPQOI_OP_RGBA) ? Utility::Read8(*stream) : pixel.a;
+            pixel = Rgba(r, g, b, a);
+        }
+        else
+        {
+            uint8_t tagOp = (tag & 0b11000000);
+            uint8_t tagOperand = (tag & 0b00111111);
+            if(tagOp == CPPQOI_OP_INDEX) // 00
+                pixel = seen[tagOperand];
+            else if(tagOp == CPPQOI_OP_DIFF) // 01
+            {
+                pixel.r += static_cast<uint8_t>( (((tagOperand & 0b110000) >> 4U) & 0x3) - 2);
+                pixel.g += static_cast<uint8_t>( (((tagOperand & 0b001100) >> 2U) & 0x3) - 2);
+                pixel.b += static_cast<uint8_t>( (((tagOperand & 0b000011) >> 0U) & 0x3) - 2);
+            }
+            else if(tagOp == CPPQOI_OP_LUMA) // 10
+            {
+                uint8_t l = Utility::Read8(*stream);
+                const uint8_t dg = static_cast<uint8_t>( static_cast<unsigned>(tagOperand) - 32);
+
+                pixel.r += static_cast<uint8_t>(dg - 8 + ((l >> 4U) & 0b00001111U));
+                pixel.g += dg;
+                pixel.b += static_cast<uint8_t>(dg - 8 + ((l >> 0U) & 0b00001111U));
+            }
+            else if(tagOp == CPPQOI_OP_RUN) // 11
+                run = tagOperand;
+        }
+        seen[HashPixel(pixel) % 64] = pixel;
+        pixelIndex++;
+        return pixel;
+    }
+
+    uint32_t GetWidth(void)
+    {
+        return width;
+    }
+
+    uint32_t GetHeight(void)
+    {
+        return height;
+    }
+
+    uint32_t GetChannels(void)
+    {
+        return channels;
+    }
+
+    uint8_t GetColorspace(void)
+    {
+        return colorspace;
+    }
+
+    bool IsGood(void)
+    {
+        return stream != nullptr && stream->good();
+    }
+
+    uint64_t GetPixelIndex(void)
+    {
+        return pixelIndex;
+    }
+private:
+
+    bool LoadHeader( std::istream& str)
+    {
+        for(uint32_t i = 0; i < CPPQOI_MAGIC.size(); i++)
+            if(Utility::Read8(str) != CPPQOI_MAGIC[i])
+                return false;
+        width = Utility::Read32(str);
+        height = Utility::Read32(str);
+        channels = Utility::Read8(str);
+        colorspace = Utility::Read8(str);
+        return channels >= 3 && channels <= 4 && (colorspace == 0 || colorspace == 1) && width != 0 && height != 0 && str.good();
+    }
+
+    std::array<Rgba, 64> seen;
+    Rgba pixel;
+    uint8_t run;
+
+    std::shared_ptr<std::istream> stream;
+    uint32_t width; /// width of the image (>0)
+    uint32_t height; /// height of the image (>0)
+    uint8_t channels; /// channels, 3=RGB, 4=RGBA
+    uint8_t colorspace; ///colorspace, 0 = sRGB, 1 = linear
+    uint64_t pixelIndex ;
+};
+
+namespace Detail
+{
+
+/**
+  * @brief Number of pixels of a width x height image, computed in 64 bits.
+  * @param bytesPerPixel Largest number of bytes that will be stored per pixel.
+  * @return False if that many bytes, plus room for the header and end tag, do not fit in size_t.
+  */
+inline bool PixelCount(uint32_t width, uint32_t height, size_t bytesPerPixel, size_t& count)
+{
+    uint64_t pixels = static_cast<uint64_t>(width) * height;
+    if(pixels > (std::numeric_limits<size_t>::max() - 64) / bytesPerPixel)
+        return false;
+    count = static_cast<size_t>(pixels);
+    return true;
+}
+
+/**
+  * @brief Reads and validates the header of the QOI file at data into qoi.
+  * qoi.channels is set to the channels pixelData will be decoded to.
+  */
+inline bool ReadHeader(QoiFile& qoi, const uint8_t* data, size_t size, const QoiDecodeOptions& options)
+{
+    if(size < CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size())
+        return false; //we can't even read in our header to verify it
+
+
+    size_t position = 0;
+    for(size_t i = 0; i < CPPQOI_MAGIC.size(); i++)
+        if(data[position++] != CPPQOI_MAGIC[i])
+            return false;
+
+    qoi.width = Utility::Read32(data, position);
+    qoi.height = Utility::Read32(data, position);
+    qoi.channels = data[position++];
+    qoi.colorspace = data[position++];
+
+    if(qoi.channels < 3 || qoi.channels > 4 || (qoi.colorspace != 0 && qoi.colorspace != 1) ||  qoi.width == 0 || qoi.height == 0)
+        return false;
+    if(options.channels != 0 && (options.channels < 3 || options.channels > 4))
+        return false;
+    if(options.layout != QoiLayout::Linear && (options.tileSize == 0 || options.tileSize > 256 || (options.tileSize & (options.tileSize - 1)) != 0))
+        return false;
+
+    //pixelData is laid out with the requested channels, qoi.channels describes that layout
+    if(options.channels != 0)
+        qoi.channels = options.channels;
+    return true;
+}
+
+}
+
+namespace Detail
+{
+
+/**
+  * @brief Spreads the bits of v apart, bit i moves to bit 2 * i.
+  */
+constexpr uint32_t SpreadBits(uint32_t v)
+{
+    v &= 0xffff;
+    v = (v | v << 8) & 0x00ff00ff;
+    v = (v | v << 4) & 0x0f0f0f0f;
+    v = (v | v << 2) & 0x33333333;
+    return (v | v << 1) & 0x55555555;
+}
+
+/**
+  * @brief Decodes the op data in [data, end) into the tiled layout of options, without a second pass over pixelData.
+  * Rows are decoded in file order into a row buffer, every span of the row that is contiguous in
+  * the layout, a tile row for Tiled and a pixel pair for Morton, is then copied to its final place.
+  * @param qoi Header fields as read by ReadHeader, receives the padded pixelData.
+  * @param crc If not null, continued over every row of consumed op data.
+  * @return The position in data after the consumed ops, nullptr if the padded image is too large.
+  */
+inline const uint8_t* DecodeTiled(QoiFile& qoi, const uint8_t* data, const uint8_t* end, const QoiDecodeOptions& options, uint32_t* crc)
+{
+    uint64_t tile = options.tileSize;
+    uint64_t tilesX = (qoi.width + tile - 1) / tile, tilesY = (qoi.height + tile - 1) / tile;
+    size_t pixelCount;
+    if(tilesX * tile > std::numeric_limits<uint32_t>::max() || tilesY * tile > std::numeric_limits<uint32_t>::max() ||
+       !PixelCount(static_cast<uint32_t>(tilesX * tile), static_cast<uint32_t>(tilesY * tile), qoi.channels, pixelCount))
+        return nullptr;
+    if(pixelCount != static_cast<size_t>(qoi.width) * qoi.height)
+        qoi.pixelData.assign(pixelCount * qoi.channels, 0);
+    else
+        qoi.pixelData.resize(pixelCount * qoi.channels);
+
+    //the layout is separable, the index of (x, y) is the column offset of x plus the row offset of y
+    bool morton = options.layout == QoiLayout::Morton;
+    uint32_t span = morton ? std::min<uint32_t>(options.tileSize, 2) : options.tileSize;
+    std::vector<size_t> columns((static_cast<size_t>(qoi.width) + span - 1) / span);
+    for(size_t i = 0; i < columns.size(); i++)
+    {
+        uint32_t x = static_cast<uint32_t>(i * span);
+        columns[i] = (x / tile) * tile * tile + (morton ? SpreadBits(x % tile) : x % tile);
+    }
+
+    //each row is decoded at full speed into a buffer that stays in cache, then its spans are moved out
+    DecoderState state;
+    size_t spanBytes = static_cast<size_t>(span) * qoi.channels;
+    std::vector<uint8_t> rowData(columns.size() * spanBytes);
+    for(uint32_t y = 0; y < qoi.height; y++)
+    {
+        const uint8_t* rowStart = data;
+        data = qoi.channels == 4 ? DecodePixels<4>(state, data, end, rowData.data(), qoi.width) : DecodePixels<3>(state, data, end, rowData.data(), qoi.width);
+        if(crc != nullptr)
+            *crc = Utility::Crc32c(*crc, rowStart, data - rowStart);
+
+        uint8_t* out = qoi.pixelData.data() + ((y / tile) * tilesX * tile * tile + (morton ? SpreadBits(y % tile) << 1 : (y % tile) * tile)) * qoi.channels;
+        size_t last = columns.size() - 1;
+        for(size_t i = 0; i < last; i++)
+            std::memcpy(out + columns[i] * qoi.channels, rowData.data() + i * spanBytes, spanBytes);
+        std::memcpy(out + columns[last] * qoi.channels, rowData.data() + last * spanBytes, (qoi.width - last * span) * qoi.channels);
+    }
+    return data;
+}
+
+}
+
+/**
+  * @brief Decodes a QOI file of size bytes at data.
+  */
+inline bool LoadQoi(QoiFile& qoi, const uint8_t* data, size_t size, const QoiDecodeOptions& options = QoiDecodeOptions())
+{
+    if(!Detail::ReadHeader(qoi, data, size, options))
+        return false;
+    size_t position = CPPQOI_HEADER_SIZE;
+
+    //a checksum chunk after the end tag is not part of the op data
+    size_t qoiSize = Utility::StripChecksum(data, size);
+    if(options.verifyChecksum && qoiSize == size)
+        return false;
+
+    if(options.layout != QoiLayout::Linear)
+    {
+        uint32_t crc = Utility::Crc32c(0, data, position);
+        const uint8_t* end = data + qoiSize - CPPQOI_ENDTAG.size();
+        const uint8_t* in = Detail::DecodeTiled(qoi, data + position, end, options, options.verifyChecksum ? &crc : nullptr);
+        if(in == nullptr || !options.verifyChecksum)
+            return in != nullptr;
+        crc = Utility::Crc32c(crc, in, data + qoiSize - in);
+        position = qoiSize + CPPQOI_CHECKSUM_TAG.size();
+        return Utility::Read32(data, position) == crc;
+    }
+
+    size_t pixelCount;
+    if(!Detail::PixelCount(qoi.width, qoi.height, qoi.channels, pixelCount))
+        return false;
+    qoi.pixelData.resize(pixelCount * qoi.channels);
+
+    Detail::DecoderState state;
+    const uint8_t* end = data + qoiSize - CPPQOI_ENDTAG.size();
+    if(!options.verifyChecksum)
+    {
+        if(qoi.channels == 4)
+            Detail::DecodePixels<4>(state, data + position, end, qoi.pixelData.data(), pixelCount);
+        else
+            Detail::DecodePixels<3>(state, data + position, end, qoi.pixelData.data(), pixelCount);
+        return true;
+    }
+
+    //checksum every block of input right after decoding it, while it is still in cache
+    uint32_t crc = Utility::Crc32c(0, data, position);
+    const uint8_t* in = data + position;
+    for(size_t i = 0; i < pixelCount; i += Detail::CHECKSUM_BLOCK)
+    {
+        size_t count = std::min(pixelCount - i, Detail::CHECKSUM_BLOCK);
+        uint8_t* out = qoi.pixelData.data() + i * qoi.channels;
+        const uint8_t* next = qoi.channels == 4 ? Detail::DecodePixels<4>(state, in, end, out, count) : Detail::DecodePixels<3>(state, in, end, out, count);
+        crc = Utility::Crc32c(crc, in, next - in);
+        in = next;
+    }
+    crc = Utility::Crc32c(crc, in, data + qoiSize - in);
+    position = qoiSize + CPPQOI_CHECKSUM_TAG.size();
+    return Utility::Read32(data, position) == crc;
+}
+
+inline bool LoadQoi(QoiFile& qoi, const std::vector<uint8_t>& buffer, const QoiDecodeOptions& options)
+{
+    return LoadQoi(qoi, buffer.data(), buffer.size(), options);
+}
+
+inline bool LoadQoi(QoiFile& qoi, const std::vector<uint8_t>& buffer)
+{
+    return LoadQoi(qoi, buffer, QoiDecodeOptions());
+}
+
+namespace Detail
+{
+
+/**
+  * @brief Runs fn(job) for every job in [0, jobs) on up to threadCount threads, the caller included.
+  */
+template<typename Fn>
+inline void ParallelFor(size_t jobs, unsigned threadCount, Fn fn)
+{
+    std::atomic<size_t> next{0};
+    auto worker = [&]()
+    {
+        for(size_t i = next++; i < jobs; i = next++)
+            fn(i);
+    };
+    std::vector<std::thread> pool;
+    for(unsigned i = 1; i < threadCount && i < jobs; i++)
+        pool.emplace_back(worker);
+    worker();
+    for(std::thread& t : pool)
+        t.join();
+}
+
+/**
+  * @brief Byte range of the op data decoded by one thread of LoadQoiParallel.
+  */
+struct ParallelChunk
+{
+    /**
+      * @brief Decoder state captured at an op boundary of the speculative decode.
+      */
+    struct Checkpoint
+    {
+        uint64_t pixel; /// pixels of the chunk decoded before it
+        Rgba last; /// the previous pixel
+        std::array<Rgba, 64> seen;
+        uint64_t live{0}; /// index slots read after the checkpoint before being written again
+    };
+
+    size_t begin{0}; /// start of the scanned byte range, an op starts somewhere in [begin, begin + 4]
+    size_t limit{0}; /// end of the scanned byte range
+    std::array<size_t, 5> ends{}; /// per candidate start begin + k, position of the first op at or after limit
+    std::array<uint64_t, 5> pixels{}; /// per candidate start, pixels covered by its ops
+
+    size_t start{0}; /// resolved position of the first op
+    uint64_t firstPixel{0};
+    uint64_t pixelCount{0};
+
+    std::vector<Checkpoint> checkpoints;
+    DecoderState final; /// state after the speculative decode
+    std::array<uint32_t, 64> lastWrite{}; /// per index slot, number of checkpoints taken before its last write
+};
+
+/**
+  * @brief Pixels produced by the op starting with tag.
+  */
+constexpr uint64_t OpPixels(uint8_t tag)
+{
+    return (tag & 0b11000000) == CPPQOI_OP_RUN && tag < CPPQOI_OP_RGB ? (tag & 0b00111111) + 1 : 1;
+}
+
+/**
+  * @brief Walks the ops of a chunk from each of the 5 possible first op positions.
+  * Walks from different starts synchronise after a few ops, so the later candidates stop as soon as
+  * they land on an op start of the first one and reuse its counts.
+  */
+inline void ScanChunk(const uint8_t* data, ParallelChunk& chunk)
+{
+    constexpr size_t MARKS = 64;
+    std::array<std::pair<size_t, uint64_t>, MARKS> marks{};
+    size_t markCount = 0;
+
+    size_t p = chunk.begin;
+    uint64_t pixels = 0;
+    while(p < chunk.limit)
+    {
+        if(markCount < MARKS)
+            marks[markCount++] = {p, pixels};
+        pixels += OpPixels(data[p]);
+        p += OpSize(data[p]);
+    }
+    chunk.ends[0] = p;
+    chunk.pixels[0] = pixels;
+
+    for(size_t k = 1; k < chunk.ends.size(); k++)
+    {
+        size_t q = chunk.begin + k;
+        uint64_t count = 0;
+        size_t mark = 0;
+        while(q < chunk.limit)
+        {
+            while(mark < markCount && marks[mark].first < q)
+                mark++;
+            if(mark < markCount && marks[mark].first == q)
+                break;
+            count += OpPixels(data[q]);
+            q += OpSize(data[q]);
+        }
+        bool merged = q < chunk.limit;
+        chunk.ends[k] = merged ? chunk.ends[0] : q;
+        chunk.pixels[k] = merged ? count + chunk.pixels[0] - marks[mark].second : count;
+    }
+}
+
+/**
+  * @brief Decodes the ops of a chunk starting from the default decoder state.
+  * Every checkpointInterval pixels the state is captured together with the index slots that the
+  * rest of the chunk reads before writing them, which is all the fix-up needs to tell whether the
+  * true state has caught up with the speculative one.
+  */
+template<uint8_t Channels>
+inline void DecodeSpeculative(const uint8_t* data, const uint8_t* end, uint8_t* out, ParallelChunk& chunk, size_t checkpointInterval)
+{
+    DecoderState state;
+    Rgba pixel = state.pixel;
+    std::array<uint32_t, 64> marked{};
+    uint32_t taken = 0;
+
+    uint8_t* start = out;
+    uint8_t* outEnd = out + chunk.pixelCount * Channels;
+    uint8_t* nextCheckpoint = out + checkpointInterval * Channels;
+    while(out < outEnd)
+    {
+        if(state.run > 0)
+        {
+            out = DecodeRun<Channels>(state, pixel, out, outEnd);
+            continue;
+        }
+
+        if(out >= nextCheckpoint)
+        {
+            chunk.checkpoints.push_back({static_cast<uint64_t>(out - start) / Channels, pixel, state.seen, 0});
+            taken++;
+            nextCheckpoint = out + checkpointInterval * Channels;
+        }
+
+        if(data < end)
+        {
+            if((*data & 0b11000000) == CPPQOI_OP_INDEX)
+            {
+                //the slot is live at every checkpoint since it was last written
+                uint8_t slot = *data;
+                for(uint32_t j = std::max(chunk.lastWrite[slot], marked[slot]) + 1; j <= taken; j++)
+                    chunk.checkpoints[j - 1].live |= uint64_t(1) << slot;
+                marked[slot] = taken;
+            }
+            data = DecodeOp(state, pixel, data);
+            chunk.lastWrite[HashPixel(pixel) % 64] = taken;
+        }
+
+        out[0] = pixel.r;
+        out[1] = pixel.g;
+        out[2] = pixel.b;
+        if(Channels == 4)
+            out[3] = pixel.a;
+        out += Channels;
+    }
+
+    state.pixel = pixel;
+    chunk.final = state;
+}
+
+/**
+  * @brief Redoes the start of a speculatively decoded chunk from the true incoming state.
+  * Decoding stops at the first checkpoint whose previous pixel and live index slots match, from
+  * there on the speculative output is exact.
+  * @param state The true state at the start of the chunk, receives the true state at its end.
+  */
+template<uint8_t Channels>
+inline void FixUpChunk(DecoderState& state, const uint8_t* data, const uint8_t* end, uint8_t* out, const ParallelChunk& chunk)
+{
+    uint64_t done = 0;
+    const uint8_t* in = data + chunk.start;
+    for(size_t j = 0; j < chunk.checkpoints.size(); j++)
+    {
+        const ParallelChunk::Checkpoint& checkpoint = chunk.checkpoints[j];
+        in = DecodePixels<Channels>(state, in, end, out + done * Channels, checkpoint.pixel - done);
+        done = checkpoint.pixel;
+
+        bool same = state.pixel == checkpoint.last;
+        for(unsigned k = 0; k < 64 && same; k++)
+            same = !(checkpoint.live >> k & 1) || state.seen[k] == checkpoint.seen[k];
+        if(!same)
+            continue;
+
+        //slots written after the checkpoint are exact in the speculative state, the rest are not touched again
+        for(unsigned k = 0; k < 64; k++)
+            if(chunk.lastWrite[k] > j)
+                state.seen[k] = chunk.final.seen[k];
+        state.pixel = chunk.final.pixel;
+        return;
+    }
+    DecodePixels<Channels>(state, in, end, out + done * Channels, chunk.pixelCount - done);
+}
+
+/**
+  * @brief LoadQoiParallel with an explicit chunk count and checkpoint interval.
+  */
+inline bool LoadQoiParallel(QoiFile& qoi, const uint8_t* data, size_t size, const QoiDecodeOptions& options,
+                            size_t chunkCount, unsigned threadCount, size_t checkpointInterval = 4096)
+{
+    //ops are at most 5 bytes long, so every chunk needs at least that many to hold an op start
+    if(!ReadHeader(qoi, data, size, options))
+        return false;
+    size_t opStart = CPPQOI_HEADER_SIZE;
+    size_t opEnd = Utility::StripChecksum(data, size) - CPPQOI_ENDTAG.size();
+    chunkCount = std::min(chunkCount, (opEnd - opStart) / 64);
+    //the chunks decode into row-major output, tiled layouts are decoded serially
+    if(chunkCount < 2 || options.verifyChecksum || options.layout != QoiLayout::Linear)
+        return LoadQoi(qoi, data, size, options);
+
+    std::vector<ParallelChunk> chunks(chunkCount);
+    size_t step = (opEnd - opStart) / chunkCount;
+    for(size_t t = 0; t < chunkCount; t++)
+    {
+        chunks[t].begin = opStart + t * step;
+        chunks[t].limit = t + 1 == chunkCount ? opEnd : opStart + (t + 1) * step;
+    }
+    ParallelFor(chunkCount, threadCount, [&](size_t t) { ScanChunk(data, chunks[t]); });
+
+    //chain the chunks: the end of one chunk's walk picks the candidate start of the next
+    size_t pixelCount;
+    if(!PixelCount(qoi.width, qoi.height, qoi.channels, pixelCount))
+        return false;
+    uint64_t total = 0;
+    size_t position = opStart;
+    for(ParallelChunk& chunk : chunks)
+    {
+        size_t k = position - chunk.begin;
+        chunk.start = position;
+        chunk.firstPixel = std::min<uint64_t>(total, pixelCount);
+        chunk.pixelCount = std::min<uint64_t>(chunk.pixels[k], pixelCount - chunk.firstPixel);
+        total += chunk.pixels[k];
+        position = chunk.ends[k];
+    }
+    //truncated or padded op data, leave the corner cases to the sequential decoder
+    if(position != opEnd || total < pixelCount)
+        return LoadQoi(qoi, data, size, options);
+
+    qoi.pixelData.resize(pixelCount * qoi.channels);
+    const uint8_t* end = data + opEnd;
+    uint8_t channels = qoi.channels;
+    ParallelFor(chunkCount, threadCount, [&](size_t t)
+    {
+        ParallelChunk& chunk = chunks[t];
+        uint8_t* out = qoi.pixelData.data() + chunk.firstPixel * channels;
+        if(channels == 4)
+            DecodeSpeculative<4>(data + chunk.start, end, out, chunk, checkpointInterval);
+        else
+            DecodeSpeculative<3>(data + chunk.start, end, out, chunk, checkpointInterval);
+    });
+
+    //the first chunk started from the true state, the others are repaired in order
+    DecoderState state = chunks[0].final;
+    for(size_t t = 1; t < chunkCount && chunks[t].pixelCount > 0; t++)
+    {
+        uint8_t* out = qoi.pixelData.data() + chunks[t].firstPixel * channels;
+        if(channels == 4)
+            FixUpChunk<4>(state, data, end, out, chunks[t]);
+        else
+            FixUpChunk<3>(state, data, end, out, chunks[t]);
+    }
+    return true;
+}
+
+}
+
+/**
+  * @brief Decodes a standard QOI file on several threads.
+  * The op data is split into one chunk per thread. A parallel scan walks each chunk from every
+  * possible first op position to find op boundaries and pixel counts, then every chunk is decoded
+  * concurrently starting from a guessed state. A short sequential fix-up re-decodes the start of
+  * each chunk from the true state until it provably agrees with the guess. The output is identical
+  * to LoadQoi. Small files, and files to verify against a checksum, are decoded by LoadQoi.
+  * @param threadCount Number of threads, 0 uses the hardware concurrency.
+  */
+inline bool LoadQoiParallel(QoiFile& qoi, const uint8_t* data, size_t size, const QoiDecodeOptions& options = QoiDecodeOptions(), unsigned threadCount = 0)
+{
+    constexpr size_t MIN_CHUNK = 256 * 1024;
+    if(threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    return Detail::LoadQoiParallel(qoi, data, size, options, std::min<size_t>(threadCount, size / MIN_CHUNK), threadCount);
+}
+
+inline bool LoadQoiParallel(QoiFile& qoi, const std::vector<uint8_t>& buffer, const QoiDecodeOptions& options = QoiDecodeOptions(), unsigned threadCount = 0)
+{
+    return LoadQoiParallel(qoi, buffer.data(), buffer.size(), options, threadCount);
+}
+
+/**
+  * @brief Header fields of a QOI file, see ReadQoiHeader.
+  */
+struct QoiHeader
+{
+    uint32_t width{0}; /// width of the image (>0)
+    uint32_t height{0}; /// height of the image (>0)
+    uint8_t channels{0}; /// channels, 3=RGB, 4=RGBA
+    uint8_t colorspace{0}; ///colorspace, 0 = sRGB, 1 = linear
+
+    constexpr bool IsValid(void) const
+    {
+        return channels >= 3 && channels <= 4 && colorspace <= 1 && width != 0 && height != 0;
+    }
+};
+
+/**
+  * @brief Largest possible size of an encoded QOI file.
+  */
+constexpr uint64_t QoiMaxSize(uint32_t width, uint32_t height, uint8_t channels)
+{
+    return static_cast<uint64_t>(width) * height * (channels + 1) + CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size();
+}
+
+/**
+  * @brief Encoded QOI data of at most N bytes, as produced by EncodeQoi.
+  */
+template<size_t N>
+struct QoiEncoded
+{
+    std::array<uint8_t, N> data{}; /// the encoded file, only the first size bytes are used
+    size_t size{0}; /// size of the encoded file, 0 if the input was invalid
+};
+
+/**
+  * @brief Reads the header of a QOI file, usable in constant expressions.
+  * @return The header, IsValid() is false if data is not a QOI file.
+  */
+template<size_t N>
+constexpr QoiHeader ReadQoiHeader(const std::array<uint8_t, N>& data)
+{
+    QoiHeader header;
+    if(N < CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size())
+        return header;
+    for(size_t i = 0; i < CPPQOI_MAGIC.size(); i++)
+        if(data[i] != CPPQOI_MAGIC[i])
+            return header;
+    auto read32 = [&](size_t p) { return static_cast<uint32_t>(data[p]) << 24 | static_cast<uint32_t>(data[p + 1]) << 16 | static_cast<uint32_t>(data[p + 2]) << 8 | data[p + 3]; };
+    header.width = read32(4);
+    header.height = read32(8);
+    header.channels = data[12];
+    header.colorspace = data[13];
+    return header.IsValid() ? header : QoiHeader();
+}
+
+/**
+  * @brief Decodes a QOI file held in a std::array, usable in constant expressions.
+  * Intended for assets embedded in the binary, so they are expanded at build time:
+  * @code
+  * constexpr cppqoi::QoiHeader header = cppqoi::ReadQoiHeader(iconQoi);
+  * static_assert(header.IsValid());
+  * constexpr auto iconPixels = cppqoi::DecodeQoi<header.width, header.height, header.channels>(iconQoi);
+  * @endcode
+  * Large images may need a higher constexpr operation limit from the compiler.
+  * @tparam Width, Height, Channels Size of the decoded image, Channels may differ from the file's.
+  * @return The decoded pixels, all zero if the file's size does not match Width and Height.
+  */
+template<uint32_t Width, uint32_t Height, uint8_t Channels, size_t N>
+constexpr std::array<uint8_t, static_cast<size_t>(Width) * Height * Channels> DecodeQoi(const std::array<uint8_t, N>& data)
+{
+    static_assert(Channels == 3 || Channels == 4, "QOI images have 3 or 4 channels");
+    std::array<uint8_t, static_cast<size_t>(Width) * Height * Channels> pixels{};
+    QoiHeader header = ReadQoiHeader(data);
+    if(!header.IsValid() || header.width != Width || header.height != Height)
+        return pixels;
+
+    Detail::DecoderState state;
+    Detail::DecodePixels<Channels>(state, data.data() + CPPQOI_HEADER_SIZE, data.data() + N - CPPQOI_ENDTAG.size(), pixels.data(), static_cast<size_t>(Width) * Height);
+    return pixels;
+}
+
+/**
+  * @brief Encodes pixels held in a std::array, usable in constant expressions.
+  * @tparam Width, Height, Channels Size of the image in pixels.
+  * @return The encoded file, size is 0 if the arguments are invalid.
+  */
+template<uint32_t Width, uint32_t Height, uint8_t Channels, size_t N>
+constexpr QoiEncoded<QoiMaxSize(Width, Height, Channels)> EncodeQoi(const std::array<uint8_t, N>& pixels, uint8_t colorspace = 0)
+{
+    static_assert(Channels == 3 || Channels == 4, "QOI images have 3 or 4 channels");
+    static_assert(N == static_cast<size_t>(Width) * Height * Channels, "pixel data does not match the image size");
+    QoiEncoded<QoiMaxSize(Width, Height, Channels)> encoded;
+    if(Width == 0 || Height == 0 || colorspace > 1)
+        return encoded;
+
+    uint8_t* out = encoded.data.data();
+    for(uint8_t m : CPPQOI_MAGIC)
+        *out++ = m;
+    for(uint32_t value : {Width, Height})
+        for(int shift = 24; shift >= 0; shift -= 8)
+            *out++ = static_cast<uint8_t>(value >> shift);
+    *out++ = Channels;
+    *out++ = colorspace;
+
+    Detail::EncoderState state;
+    out = Detail::EncodePixels<Channels, Channels == 4>(state, pixels.data(), static_cast<size_t>(Width) * Height, true, out);
+    for(uint8_t e : CPPQOI_ENDTAG)
+        *out++ = e;
+    encoded.size = static_cast<size_t>(out - encoded.data.data());
+    return encoded;
+}
+
+inline bool IsQoi(std::istream& stream)
+{
+    size_t pos = stream.tellg();
+    bool returnV = true;
+    for(uint32_t i = 0; i < CPPQOI_MAGIC.size(); i++)
+        returnV = returnV && CPPQOI_MAGIC[i] == Utility::Read8(stream);
+    stream.seekg(pos);
+    return returnV;
+}
+
+inline bool LoadQoi(std::istream& stream, QoiFile& qoi, size_t dataCount, const QoiDecodeOptions& options = QoiDecodeOptions())
+{
+    std::vector<uint8_t> buffer(dataCount);
+    stream.read(reinterpret_cast<char*>(buffer.data()), dataCount);
+    return LoadQoi(qoi, buffer, options);
+}
+
+inline bool LoadQoi(const std::string& filename, QoiFile& qoi, const QoiDecodeOptions& options = QoiDecodeOptions())
+{
+    std::ifstream stream(filename.c_str(), std::ifstream::in | std::ifstream::binary);
+    if(!stream.is_open())
+        return false;
+    return LoadQoi(stream, qoi, std::filesystem::file_size(std::filesystem::path{filename}), options);
+}
+
+inline bool WriteQoi(const QoiFile& qoi, std::vector<uint8_t>& buffer, const QoiEncodeOptions& options)
+{
+    size_t pixelCount;
+    if(qoi.width == 0 || qoi.height == 0 || qoi.channels < 3 || qoi.channels > 4 || qoi.colorspace > 1 ||
+       !Detail::PixelCount(qoi.width, qoi.height, qoi.channels + 1, pixelCount) || qoi.pixelData.size() != pixelCount * qoi.channels)
+        return false;
+
+    bool opaque = options.detectOpaque && qoi.channels == 4 && Utility::IsOpaque(qoi.pixelData.data(), pixelCount);
+
+    size_t bufferSize = pixelCount * (qoi.channels + 1) + CPPQOI_HEADER_SIZE + sizeof(CPPQOI_ENDTAG) + CPPQOI_CHECKSUM_SIZE;
+    buffer.resize(bufferSize);
+
+    size_t position = 0;
+
+    //Write the header
+
+    for(size_t i = 0; i < CPPQOI_MAGIC.size(); i++)
+        buffer[position++] = CPPQOI_MAGIC[i];
+
+    Utility::Write32(buffer, qoi.width, position);
+    Utility::Write32(buffer, qoi.height, position);
+    buffer[position++] = opaque ? 3 : qoi.channels;
+    buffer[position++] = qoi.colorspace;
+
+    Detail::EncoderState state;
+    bool alpha = qoi.channels == 4 && !opaque;
+    uint8_t* out = buffer.data() + position;
+    if(!options.checksum)
+        out = Detail::EncodeSpan(state, options, qoi.channels, alpha, qoi.pixelData.data(), pixelCount, true, out);
+    else
+    {
+        //checksum every block of output right after encoding it, while it is still in cache
+        uint32_t crc = Utility::Crc32c(0, buffer.data(), position);
+        for(size_t i = 0; i < pixelCount; i += Detail::CHECKSUM_BLOCK)
+        {
+            size_t count = std::min(pixelCount - i, Detail::CHECKSUM_BLOCK);
+            uint8_t* start = out;
+            out = Detail::EncodeSpan(state, options, qoi.channels, alpha, qoi.pixelData.data() + i * qoi.channels, count, i + count == pixelCount, out);
+            crc = Utility::Crc32c(crc, start, out - start);
+        }
+        std::copy(CPPQOI_ENDTAG.begin(), CPPQOI_ENDTAG.end(), out);
+        crc = Utility::Crc32c(crc, out, CPPQOI_ENDTAG.size());
+        out = Detail::WriteChecksum(crc, out + CPPQOI_ENDTAG.size());
+        buffer.resize(out - buffer.data());
+        return true;
+    }
+    position = out - buffer.data();
+
+    for(size_t i = 0; i < CPPQOI_ENDTAG.size(); i++)
+        buffer[position++] = CPPQOI_ENDTAG[i];
+    buffer.resize(position);
+    return true;
+}
+
+inline bool WriteQoi(const QoiFile& qoi, std::vector<uint8_t>& buffer)
+{
+    return WriteQoi(qoi, buffer, QoiEncodeOptions());
+}
+
+
+inline bool WriteQoi(std::ostream& out, const QoiFile& qoi, const QoiEncodeOptions& options = QoiEncodeOptions())
+{
+    std::vector<uint8_t> buffer;
+    if(!WriteQoi(qoi, buffer, options))
+        return false;
+    out.write( reinterpret_cast<char*>(buffer.data()), buffer.size());
+    return !out.bad();
+}
+
+inline bool WriteQoi(const std::string& filename, const QoiFile& qoi, const QoiEncodeOptions& options = QoiEncodeOptions())
+{
+    std::ofstream stream(filename.c_str(), std::ofstream::out | std::ofstream::binary);
+    if(!stream.is_open())
+        return false;
+    return WriteQoi(stream, qoi, options);
+}
+
+namespace Detail
+{
+
+/**
+  * @brief Halves two adjacent rows into one with a 2x2 box filter.
+  * The last column of an odd parent width is dropped, a parent width of 1 repeats its only column.
+  */
+inline void DownsampleRow(const uint8_t* a, const uint8_t* b, uint32_t parentWidth, uint32_t width, uint8_t channels, uint8_t* out)
+{
+    for(uint32_t x = 0; x < width; x++)
+    {
+        size_t left = static_cast<size_t>(2 * x) * channels;
+        size_t right = static_cast<size_t>(std::min(2 * x + 1, parentWidth - 1)) * channels;
+        for(uint8_t c = 0; c < channels; c++)
+            *out++ = static_cast<uint8_t>((a[left + c] + a[right + c] + b[left + c] + b[right + c] + 2) / 4);
+    }
+}
+
+/**
+  * @brief Row by row encoder of one level of a mip chain.
+  */
+struct MipEncoder
+{
+    void Begin(std::vector<uint8_t>& output, uint32_t w, uint32_t h, uint8_t c, uint8_t cs, bool opaque, bool withChecksum)
+    {
+        buffer = &output;
+        width = w;
+        height = h;
+        channels = c;
+        alpha = c == 4 && !opaque;
+        row = 0;
+        rowData.resize(static_cast<size_t>(width) * channels);
+
+        output.resize(static_cast<size_t>(width) * height * (channels + 1) + CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size() + CPPQOI_CHECKSUM_SIZE);
+        position = 0;
+        for(size_t i = 0; i < CPPQOI_MAGIC.size(); i++)
+            output[position++] = CPPQOI_MAGIC[i];
+        Utility::Write32(output, width, position);
+        Utility::Write32(output, height, position);
+        output[position++] = alpha ? 4 : 3;
+        output[position++] = cs;
+
+        checksum = withChecksum;
+        crc = checksum ? Utility::Crc32c(0, output.data(), position) : 0;
+    }
+
+    void Encode(const QoiEncodeOptions& options, const uint8_t* data, uint32_t rows)
+    {
+        row += rows;
+        uint8_t* start = buffer->data() + position;
+        uint8_t* out = EncodeSpan(state, options, channels, alpha, data, static_cast<size_t>(width) * rows, row == height, start);
+        if(checksum)
+            crc = Utility::Crc32c(crc, start, out - start);
+        position = out - buffer->data();
+    }
+
+    void End(void)
+    {
+        uint8_t* out = std::copy(CPPQOI_ENDTAG.begin(), CPPQOI_ENDTAG.end(), buffer->data() + position);
+        if(checksum)
+            out = WriteChecksum(Utility::Crc32c(crc, out - CPPQOI_ENDTAG.size(), CPPQOI_ENDTAG.size()), out);
+        buffer->resize(out - buffer->data());
+    }
+
+    std::vector<uint8_t>* buffer{nullptr};
+    size_t position{0};
+    EncoderState state;
+    uint32_t width{0};
+    uint32_t height{0};
+    uint8_t channels{0};
+    bool alpha{true};
+    bool checksum{false};
+    uint32_t crc{0}; /// CRC32C of the output so far
+    uint32_t row{0}; /// rows encoded so far
+    std::vector<uint8_t> rowData; /// the most recently generated row
+    std::vector<uint8_t> evenRow; /// even parent row waiting for its odd partner
+};
+
+/**
+  * @brief Hands row y of level - 1 to level, generating and encoding a row of level once both parents exist.
+  */
+inline void PushMipRow(std::vector<MipEncoder>& mips, const QoiEncodeOptions& options, size_t level, const uint8_t* parent, uint32_t y)
+{
+    if(level >= mips.size())
+        return;
+    const MipEncoder& up = mips[level - 1];
+    MipEncoder& mip = mips[level];
+
+    const uint8_t* other = parent;
+    if(up.height > 1)
+    {
+        if(y / 2 >= mip.height) //trailing row of an odd parent height
+            return;
+        if(y % 2 == 0)
+        {
+            mip.evenRow.assign(parent, parent + static_cast<size_t>(up.width) * up.channels);
+            return;
+        }
+        other = mip.evenRow.data();
+    }
+
+    DownsampleRow(other, parent, up.width, mip.width, mip.channels, mip.rowData.data());
+    mip.Encode(options, mip.rowData.data(), 1);
+    PushMipRow(mips, options, level + 1, mip.rowData.data(), mip.row - 1);
+}
+
+}
+
+/**
+  * @brief Encodes qoi and its mip chain in a single pass over the source.
+  * Every level halves the one above it, rounding down but never below 1, with a 2x2 box filter on
+  * the straight (not premultiplied) channels. A row of a level is generated and encoded as soon as
+  * its two parent rows exist, so no level is ever held in full and the source is read once. With
+  * more than one thread level 0 is encoded on a worker while the calling thread generates and
+  * encodes all smaller levels, which together hold about a third of the pixels.
+  * @param levels Receives one encoded QOI file per level, level 0 first.
+  * @param maxLevels Maximum number of levels including level 0, 0 produces the full chain down to 1x1.
+  * @param threadCount Number of threads, 0 uses the hardware concurrency.
+  * @return False if qoi is not a valid image.
+  */
+inline bool WriteQoiMips(const QoiFile& qoi, std::vector<std::vector<uint8_t>>& levels, const QoiEncodeOptions& options = QoiEncodeOptions(),
+                         unsigned maxLevels = 0, unsigned threadCount = 0)
+{
+    size_t pixelCount;
+    if(qoi.width == 0 || qoi.height == 0 || qoi.channels < 3 || qoi.channels > 4 || qoi.colorspace > 1 ||
+       !Detail::PixelCount(qoi.width, qoi.height, qoi.channels + 1, pixelCount) || qoi.pixelData.size() != pixelCount * qoi.channels)
+        return false;
+
+    size_t levelCount = 1;
+    for(uint32_t w = qoi.width, h = qoi.height; (w > 1 || h > 1) && (maxLevels == 0 || levelCount < maxLevels); levelCount++)
+    {
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+    }
+
+    //averages of opaque pixels stay opaque, so one check covers every level
+    bool opaque = options.detectOpaque && qoi.channels == 4 && Utility::IsOpaque(qoi.pixelData.data(), pixelCount);
+
+    levels.assign(levelCount, std::vector<uint8_t>());
+    std::vector<Detail::MipEncoder> mips(levelCount);
+    for(size_t i = 0, w = qoi.width, h = qoi.height; i < levelCount; i++, w = std::max<size_t>(1, w / 2), h = std::max<size_t>(1, h / 2))
+        mips[i].Begin(levels[i], static_cast<uint32_t>(w), static_cast<uint32_t>(h), qoi.channels, qoi.colorspace, opaque, options.checksum);
+
+    if(threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::thread worker;
+    if(threadCount > 1)
+        worker = std::thread([&]() { mips[0].Encode(options, qoi.pixelData.data(), qoi.height); });
+
+    size_t rowSize = static_cast<size_t>(qoi.width) * qoi.channels;
+    for(uint32_t y = 0; y < qoi.height; y++)
+    {
+        const uint8_t* row = qoi.pixelData.data() + y * rowSize;
+        if(threadCount <= 1)
+            mips[0].Encode(options, row, 1);
+        Detail::PushMipRow(mips, options, 1, row, y);
+    }
+
+    if(worker.joinable())
+        worker.join();
+    for(Detail::MipEncoder& mip : mips)
+        mip.End();
+    return true;
+}
+
+
+
+/**
+  * @brief Incrementally encodes pixels to a QOI stream.
+  * The header is written on creation, pixels are appended with Put or Write and
+  * encoded output is flushed to the underlying stream in small blocks, so memory use
+  * does not depend on the image size.
+  */
+class QoiOStream
+{
+public:
+
+    QoiOStream() { }
+    QoiOStream(std::shared_ptr<std::ostream> str, uint32_t w, uint32_t h, uint8_t c, uint8_t cs) { Create(str, w, h, c, cs); }
+    QoiOStream(const std::string& str, uint32_t w, uint32_t h, uint8_t c, uint8_t cs) { Open(str, w, h, c, cs); }
+    ~QoiOStream() { Close(); }
+
+    bool Open(const std::string& filename, uint32_t w, uint32_t h, uint8_t c, uint8_t cs)
+    {
+        std::shared_ptr<std::ofstream> file = std::make_shared<std::ofstream>(filename.c_str(), std::ofstream::out | std::ofstream::binary);
+        if(file == nullptr || !file->is_open())
+            return false;
+        return Create(file, w, h, c, cs);
+    }
+
+    bool Create(std::shared_ptr<std::ostream> str, uint32_t w, uint32_t h, uint8_t c, uint8_t cs)
+    {
+        stream = nullptr;
+        if(str == nullptr || !str->good() || c < 3 || c > 4 || cs > 1 || w == 0 || h == 0)
+            return false;
+
+        width = w;
+        height = h;
+        channels = c;
+        colorspace = cs;
+        pixelIndex = 0;
+        options = QoiEncodeOptions();
+        crc = 0;
+        state = Detail::EncoderState();
+        buffer.resize(BUFFER_SIZE);
+        position = 0;
+
+        for(size_t i = 0; i < CPPQOI_MAGIC.size(); i++)
+            buffer[position++] = CPPQOI_MAGIC[i];
+        Utility::Write32(buffer, width, position);
+        Utility::Write32(buffer, height, position);
+        buffer[position++] = channels;
+        buffer[position++] = colorspace;
+
+        stream = str;
+        return true;
+    }
+
+    /**
+      * @brief Selects the speed preset, see QoiPreset.
+      * @return False if pixels were already written, the preset cannot change within an image.
+      */
+    bool SetPreset(QoiPreset p)
+    {
+        if(pixelIndex != 0)
+            return false;
+        options.preset = p;
+        return true;
+    }
+
+    /**
+      * @brief Appends a CRC32C chunk on Close, computed over each block of output as it is flushed.
+      * @return False if pixels were already written.
+      */
+    bool SetChecksum(bool enable)
+    {
+        if(pixelIndex != 0)
+            return false;
+        options.checksum = enable;
+        return true;
+    }
+
+    QoiOStream& operator<<(const Rgba& pixel)
+    {
+        Put(pixel);
+        return *this;
+    }
+
+    /**
+      * @brief Appends a single pixel.
+      * @return False if the stream is not open or already holds width * height pixels.
+      */
+    bool Put(const Rgba& pixel)
+    {
+        if(stream == nullptr || pixelIndex >= static_cast<uint64_t>(width) * height)
+            return false;
+        //worst case is a pending RUN op followed by an RGBA op
+        if(position + 6 > buffer.size() && !Flush())
+            return false;
+        bool last = ++pixelIndex == static_cast<uint64_t>(width) * height;
+        uint8_t* out = buffer.data() + position;
+        if(options.preset == QoiPreset::Fastest)
+            out = channels == 3 ? Detail::EncodePixelFastest<false>(state, Rgba(pixel.r, pixel.g, pixel.b, 255), last, out)
+                                : Detail::EncodePixelFastest(state, pixel, last, out);
+        else if(channels == 3)
+            out = Detail::EncodePixel<false>(state, Rgba(pixel.r, pixel.g, pixel.b, 255), last, out);
+        else
+            out = Detail::EncodePixel(state, pixel, last, out);
+        position = out - buffer.data();
+        return true;
+    }
+
+    /**
+      * @brief Appends raw pixels, typically one row.
+      * @param data Interleaved pixel data.
+      * @param count Number of pixels in data.
+      * @param dataChannels Channels of data, 3=RGB, 4=RGBA. Alpha is dropped when encoding 3 channels.
+      */
+    bool Write(const uint8_t* data, size_t count, uint8_t dataChannels)
+    {
+        uint64_t pixelCount = static_cast<uint64_t>(width) * height;
+        if(stream == nullptr || (dataChannels != 3 && dataChannels != 4) || count > pixelCount - pixelIndex)
+            return false;
+
+        while(count > 0)
+        {
+            //encode as many pixels as are guaranteed to fit the buffer
+            if(buffer.size() - position < 5 * 64 && !Flush())
+                return false;
+            //5 bytes per pixel plus one for a run left pending by the previous call
+            size_t chunk = std::min<size_t>(count, (buffer.size() - position - 1) / 5);
+            pixelIndex += chunk;
+            bool last = pixelIndex == pixelCount;
+            uint8_t* out = Detail::EncodeSpan(state, options, dataChannels, channels == 4 && dataChannels == 4, data, chunk, last, buffer.data() + position);
+            position = out - buffer.data();
+            data += chunk * dataChannels;
+            count -= chunk;
+        }
+        return true;
+    }
+
+    /**
+      * @brief Writes the end tag and flushes the remaining output.
+      * @return True if every pixel was written and the stream is still good.
+      */
+    bool Close(void)
+    {
+        if(stream == nullptr)
+            return false;
+        bool complete = pixelIndex == static_cast<uint64_t>(width) * height;
+        if(position + CPPQOI_ENDTAG.size() > buffer.size())
+            Flush();
+        for(size_t i = 0; i < CPPQOI_ENDTAG.size(); i++)
+            buffer[position++] = CPPQOI_ENDTAG[i];
+        bool success = Flush() && complete;
+        if(options.checksum)
+        {
+            position = Detail::WriteChecksum(crc, buffer.data()) - buffer.data();
+            success = !stream->write(reinterpret_cast<const char*>(buffer.data()), position).bad() && success;
+            position = 0;
+        }
+        stream->flush();
+        stream = nullptr;
+        return success;
+    }
+
+    bool IsGood(void)
+    {
+        return stream != nullptr && stream->good();
+    }
+
+    uint64_t GetPixelIndex(void)
+    {
+        return pixelIndex;
+    }
+
+private:
+
+    bool Flush(void)
+    {
+        if(options.checksum)
+            crc = Utility::Crc32c(crc, buffer.data(), position);
+        stream->write(reinterpret_cast<const char*>(buffer.data()), position);
+        position = 0;
+        return !stream->bad();
+    }
+
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    Detail::EncoderState state;
+    std::vector<uint8_t> buffer;
+    size_t position{0};
+
+    std::shared_ptr<std::ostream> stream;
+    uint32_t width{0}; /// width of the image (>0)
+    uint32_t height{0}; /// height of the image (>0)
+    uint8_t channels{0}; /// channels, 3=RGB, 4=RGBA
+    uint8_t colorspace{0}; ///colorspace, 0 = sRGB, 1 = linear
+    uint64_t pixelIndex{0};
+    QoiEncodeOptions options; /// only the preset and checksum apply to stream writing
+    uint32_t crc{0}; /// CRC32C of the output flushed so far
+};
+
+/**
+  * @brief Incremental decoder fed with arbitrary chunks of a QOI file.
+  * Bytes are pushed in as they arrive, e.g. from a non-blocking socket, and every row is handed
+  * to the row callback as soon as it is complete. Ops cut off at the end of a chunk are kept
+  * until the next Feed, so chunk boundaries can fall anywhere. Feed never blocks or waits for data.
+  */
+class QoiPushDecoder
+{
+public:
+
+    /**
+      * @brief Receives a decoded row and its index, the row is only valid during the call.
+      */
+    typedef std::function<void(const uint8_t* row, uint32_t y)> RowCallback;
+
+    QoiPushDecoder() { }
+
+    /**
+      * @param callback Called once per decoded row, in order.
+      * @param outputChannels Channels of the emitted rows, 0 keeps the file's.
+      */
+    QoiPushDecoder(RowCallback callback, uint8_t outputChannels = 0) { Reset(callback, outputChannels); }
+
+    /**
+      * @brief Prepares the decoder for a new image.
+      */
+    void Reset(RowCallback callback, uint8_t outputChannels = 0)
+    {
+        onRow = callback;
+        requestedChannels = outputChannels;
+        state = Detail::DecoderState();
+        header.clear();
+        pending.clear();
+        row.clear();
+        rowFill = 0;
+        rowIndex = 0;
+        width = height = 0;
+        channels = colorspace = 0;
+        outChannels = 0;
+        failed = requestedChannels != 0 && requestedChannels != 3 && requestedChannels != 4;
+    }
+
+    /**
+      * @brief Decodes as much of the image as the bytes received so far allow.
+      * Bytes after the last pixel, such as the end tag, are ignored.
+      * @return False if the data is not a valid QOI file.
+      */
+    bool Feed(const uint8_t* data, size_t size)
+    {
+        if(failed)
+            return false;
+        const uint8_t* end = data + size;
+
+        if(!HasHeader())
+        {
+            size_t take = std::min<size_t>(CPPQOI_HEADER_SIZE - header.size(), size);
+            header.insert(header.end(), data, data + take);
+            data += take;
+            if(header.size() < CPPQOI_HEADER_SIZE)
+                return true;
+            if(!ReadHeader())
+            {
+                failed = true;
+                return false;
+            }
+        }
+
+        //complete an op that was cut off by the previous chunk
+        if(!pending.empty() && !IsComplete())
+        {
+            size_t need = Detail::OpSize(pending[0]);
+            size_t take = std::min<size_t>(need - pending.size(), end - data);
+            pending.insert(pending.end(), data, data + take);
+            data += take;
+            if(pending.size() < need)
+                return true;
+            const uint8_t* op = pending.data();
+            Decode(op, op + need);
+            pending.clear();
+        }
+
+        data = Decode(data, end);
+        if(!IsComplete())
+            pending.assign(data, end);
+        return true;
+    }
+
+    bool Feed(const std::vector<uint8_t>& data)
+    {
+        return Feed(data.data(), data.size());
+    }
+
+    bool HasHeader(void) const
+    {
+        return width != 0;
+    }
+
+    /**
+      * @return True once every row has been emitted.
+      */
+    bool IsComplete(void) const
+    {
+        return HasHeader() && rowIndex == height;
+    }
+
+    bool IsGood(void) const
+    {
+        return !failed;
+    }
+
+    uint32_t GetWidth(void) const { return width; }
+    uint32_t GetHeight(void) const { return height; }
+    uint8_t GetChannels(void) const { return channels; }
+    uint8_t GetColorspace(void) const { return colorspace; }
+    uint8_t GetOutputChannels(void) const { return outChannels; }
+
+    /**
+      * @return Number of rows emitted so far.
+      */
+    uint32_t GetRowIndex(void) const
+    {
+        return rowIndex;
+    }
+
+private:
+
+    bool ReadHeader(void)
+    {
+        if(!std::equal(CPPQOI_MAGIC.begin(), CPPQOI_MAGIC.end(), header.begin()))
+            return false;
+        size_t position = CPPQOI_MAGIC.size();
+        uint32_t w = Utility::Read32(header, position);
+        uint32_t h = Utility::Read32(header, position);
+        channels = header[position++];
+        colorspace = header[position++];
+        if(w == 0 || h == 0 || channels < 3 || channels > 4 || colorspace > 1)
+            return false;
+        width = w;
+        height = h;
+        outChannels = requestedChannels ? requestedChannels : channels;
+        row.resize(static_cast<size_t>(width) * outChannels);
+        return true;
+    }
+
+    /**
+      * @brief Decodes the complete ops in [data, end), emitting every row that fills up.
+      * @return The position of the first op that is cut off by end.
+      */
+    const uint8_t* Decode(const uint8_t* data, const uint8_t* end)
+    {
+        while(!IsComplete())
+        {
+            size_t written;
+            uint8_t* out = row.data() + rowFill * outChannels;
+            if(outChannels == 4)
+                data = Detail::DecodeAvailable<4>(state, data, end, out, width - rowFill, written);
+            else
+                data = Detail::DecodeAvailable<3>(state, data, end, out, width - rowFill, written);
+            rowFill += static_cast<uint32_t>(written);
+
+            if(rowFill < width)
+                break;
+            if(onRow)
+                onRow(row.data(), rowIndex);
+            rowIndex++;
+            rowFill = 0;
+        }
+        return data;
+    }
+
+    RowCallback onRow;
+    Detail::DecoderState state;
+    std::vector<uint8_t> header; /// header bytes received so far
+    std::vector<uint8_t> pending; /// start of an op cut off by the end of the last chunk
+    std::vector<uint8_t> row;
+    uint32_t rowFill{0}; /// pixels of the current row decoded so far
+    uint32_t rowIndex{0};
+
+    uint32_t width{0};
+    uint32_t height{0};
+    uint8_t channels{0};
+    uint8_t colorspace{0};
+    uint8_t requestedChannels{0};
+    uint8_t outChannels{0};
+    bool failed{false};
+};
+
+/**
+  * @brief Encodes a raw file of interleaved pixels, laid out as described by header, to a QOI file.
+  * The raw file is read and encoded one window at a time, so memory use is bounded by windowBytes
+  * and not by the image, which may be larger than memory or a 32 bit address space.
+  * The preset, checksum and detectOpaque options apply, detectOpaque reads the raw file twice.
+  * @param windowBytes Number of raw bytes read per window, at least one pixel is read.
+  * @return False if the raw file does not hold exactly width * height * channels bytes or on an I/O error,
+  *         qoiFile is then left as it was.
+  */
+inline bool WriteQoiFromRaw(const std::string& rawFile, const QoiHeader& header, const std::string& qoiFile,
+                            const QoiEncodeOptions& options = QoiEncodeOptions(), size_t windowBytes = 64 * 1024 * 1024)
+{
+    if(!header.IsValid())
+        return false;
+    std::error_code error;
+    uint64_t pixelCount = static_cast<uint64_t>(header.width) * header.height;
+    uint64_t rawSize = std::filesystem::file_size(std::filesystem::path{rawFile}, error);
+    if(error || rawSize != pixelCount * header.channels)
+        return false;
+    std::ifstream raw(rawFile.c_str(), std::ifstream::in | std::ifstream::binary);
+    if(!raw.is_open())
+        return false;
+
+    size_t windowPixels = std::max<size_t>(1, windowBytes / header.channels);
+    std::vector<uint8_t> window(static_cast<size_t>(std::min<uint64_t>(windowPixels, pixelCount)) * header.channels);
+    auto read = [&](uint64_t pixel, size_t& count)
+    {
+        count = static_cast<size_t>(std::min<uint64_t>(windowPixels, pixelCount - pixel));
+        return !raw.read(reinterpret_cast<char*>(window.data()), count * header.channels).fail();
+    };
+
+    //one pass over the raw file decides whether the alpha channel can be dropped
+    bool opaque = options.detectOpaque && header.channels == 4;
+    for(uint64_t pixel = 0; opaque && pixel < pixelCount; )
+    {
+        size_t count;
+        if(!read(pixel, count))
+            return false;
+        opaque = Utility::IsOpaque(window.data(), count);
+        pixel += count;
+    }
+    raw.seekg(0);
+
+    //encode to a temporary and rename it on success, a failed encode never leaves a complete looking file
+    std::string tempFile = qoiFile + ".tmp";
+    bool success;
+    {
+        QoiOStream out;
+        success = out.Open(tempFile, header.width, header.height, opaque ? 3 : header.channels, header.colorspace);
+        out.SetPreset(options.preset);
+        out.SetChecksum(options.checksum);
+        for(uint64_t pixel = 0; success && pixel < pixelCount; )
+        {
+            size_t count;
+            success = read(pixel, count) && out.Write(window.data(), count, header.channels);
+            pixel += count;
+        }
+        success = out.Close() && success;
+    }
+    if(success)
+        std::filesystem::rename(std::filesystem::path{tempFile}, std::filesystem::path{qoiFile}, error);
+    if(!success || error)
+        std::filesystem::remove(std::filesystem::path{tempFile}, error);
+    return success && !error;
+}
+
+/**
+  * @brief Decodes a QOI file of any size to a raw file of interleaved pixels.
+  * The QOI file is read through a QoiPushDecoder one window at a time and decoded rows are
+  * collected into windows before they are written, so memory use is bounded by about twice
+  * windowBytes plus one row, independent of the image size.
+  * With verifyChecksum the CRC32C is computed over each window of input as it is read.
+  * The raw file is always row-major, options.layout does not apply.
+  * @param header Receives the header of the QOI file, its channels are those of the raw file.
+  * @param windowBytes Number of bytes per read and per write.
+  * @return False on an invalid or truncated file, a checksum mismatch or an I/O error,
+  *         the raw file may then hold part of the image.
+  */
+inline bool LoadQoiToRaw(const std::string& qoiFile, const std::string& rawFile, QoiHeader& header,
+                         const QoiDecodeOptions& options = QoiDecodeOptions(), size_t windowBytes = 64 * 1024 * 1024)
+{
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(std::filesystem::path{qoiFile}, error);
+    if(error || size < CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size())
+        return false;
+    std::ifstream in(qoiFile.c_str(), std::ifstream::in | std::ifstream::binary);
+    if(!in.is_open())
+        return false;
+
+    //the checksum chunk sits at the very end, read it before streaming the rest
+    uint32_t expected = 0;
+    if(options.verifyChecksum)
+    {
+        std::array<uint8_t, CPPQOI_ENDTAG.size() + CPPQOI_CHECKSUM_SIZE> tail;
+        if(size < CPPQOI_HEADER_SIZE + tail.size() || !in.seekg(size - tail.size()) ||
+           !in.read(reinterpret_cast<char*>(tail.data()), tail.size()))
+            return false;
+        //the end tag followed by the checksum tag, like StripChecksum looks for
+        if(!std::equal(CPPQOI_ENDTAG.begin(), CPPQOI_ENDTAG.end(), tail.begin()) ||
+           !std::equal(CPPQOI_CHECKSUM_TAG.begin(), CPPQOI_CHECKSUM_TAG.end(), tail.begin() + CPPQOI_ENDTAG.size()))
+            return false;
+        size_t position = tail.size() - sizeof(uint32_t);
+        expected = Utility::Read32(tail.data(), position);
+        size -= CPPQOI_CHECKSUM_SIZE;
+        in.seekg(0);
+    }
+
+    std::ofstream raw(rawFile.c_str(), std::ofstream::out | std::ofstream::binary);
+    if(!raw.is_open())
+        return false;
+
+    windowBytes = std::max<size_t>(1, windowBytes);
+    std::vector<uint8_t> output;
+    QoiPushDecoder decoder([&](const uint8_t* row, uint32_t)
+    {
+        size_t rowSize = static_cast<size_t>(decoder.GetWidth()) * decoder.GetOutputChannels();
+        output.insert(output.end(), row, row + rowSize);
+        if(output.size() >= windowBytes)
+        {
+            raw.write(reinterpret_cast<const char*>(output.data()), output.size());
+            output.clear();
+        }
+    }, options.channels);
+
+    //with verifyChecksum the end tag is read too, the checksum covers it
+    std::vector<uint8_t> input(static_cast<size_t>(std::min<uint64_t>(windowBytes, size)));
+    uint32_t crc = 0;
+    for(uint64_t position = 0; position < size && (options.verifyChecksum || !decoder.IsComplete()); )
+    {
+        size_t count = static_cast<size_t>(std::min<uint64_t>(input.size(), size - position));
+        if(!in.read(reinterpret_cast<char*>(input.data()), count) || !decoder.Feed(input.data(), count))
+            return false;
+        if(options.verifyChecksum)
+            crc = Utility::Crc32c(crc, input.data(), count);
+        position += count;
+    }
+    if(!decoder.IsComplete() || (options.verifyChecksum && crc != expected))
+        return false;
+
+    header = {decoder.GetWidth(), decoder.GetHeight(), decoder.GetOutputChannels(), decoder.GetColorspace()};
+    raw.write(reinterpret_cast<const char*>(output.data()), output.size());
+    raw.flush();
+    return !raw.fail();
+}
+
+
+#ifdef CPPQOI_COROUTINES
+/**
+  * @brief Generator of lazily decoded image rows, created by DecodeRows.
+  * Every row is decoded only when it is requested and handed out as a span into a row buffer
+  * that is reused for the next row. Several generators can be advanced in turn on one thread,
+  * dropping a generator stops decoding without touching the remaining rows.
+  */
+class QoiRowGenerator
+{
+public:
+
+    struct promise_type
+    {
+        std::span<const uint8_t> row;
+
+        QoiRowGenerator get_return_object()
+        {
+            return QoiRowGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(std::span<const uint8_t> r) noexcept
+        {
+            row = r;
+            return {};
+        }
+        void return_void() { }
+        void unhandled_exception() { throw; }
+    };
+
+    class iterator
+    {
+    public:
+        using value_type = std::span<const uint8_t>;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() { }
+        explicit iterator(QoiRowGenerator* g) : generator(g) { }
+
+        iterator& operator++()
+        {
+            if(!generator->Next())
+                generator = nullptr;
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+        std::span<const uint8_t> operator*() const { return generator->GetRow(); }
+        bool operator==(const iterator& o) const { return generator == o.generator; }
+
+    private:
+        QoiRowGenerator* generator{nullptr};
+    };
+
+    QoiRowGenerator() { }
+    QoiRowGenerator(QoiRowGenerator&& o) noexcept { *this = std::move(o); }
+    QoiRowGenerator& operator=(QoiRowGenerator&& o) noexcept
+    {
+        std::swap(handle, o.handle);
+        width = o.width;
+        height = o.height;
+        channels = o.channels;
+        colorspace = o.colorspace;
+        rowIndex = o.rowIndex;
+        return *this;
+    }
+    QoiRowGenerator(const QoiRowGenerator&) = delete;
+    QoiRowGenerator& operator=(const QoiRowGenerator&) = delete;
+    ~QoiRowGenerator()
+    {
+        if(handle)
+            handle.destroy();
+    }
+
+    /**
+      * @brief Decodes the next row.
+      * @return False once every row was produced, or if the image was invalid.
+      */
+    bool Next(void)
+    {
+        if(!handle || handle.done())
+            return false;
+        handle.resume();
+        if(handle.done())
+            return false;
+        rowIndex++;
+        return true;
+    }
+
+    /**
+      * @brief The most recently decoded row, valid until the next call to Next.
+      */
+    std::span<const uint8_t> GetRow(void) const
+    {
+        return handle ? handle.promise().row : std::span<const uint8_t>();
+    }
+
+    iterator begin()
+    {
+        return Next() ? iterator(this) : iterator();
+    }
+
+    iterator end()
+    {
+        return iterator();
+    }
+
+    bool IsValid(void) const
+    {
+        return static_cast<bool>(handle);
+    }
+
+    uint32_t GetWidth(void) const
+    {
+        return width;
+    }
+
+    uint32_t GetHeight(void) const
+    {
+        return height;
+    }
+
+    uint8_t GetChannels(void) const
+    {
+        return channels;
+    }
+
+    uint8_t GetColorspace(void) const
+    {
+        return colorspace;
+    }
+
+    /**
+      * @brief Number of rows produced so far, the current row is GetRowIndex() - 1.
+      */
+    uint32_t GetRowIndex(void) const
+    {
+        return rowIndex;
+    }
+
+private:
+
+    explicit QoiRowGenerator(std::coroutine_handle<promise_type> h) : handle(h) { }
+
+    friend QoiRowGenerator DecodeRows(const std::vector<uint8_t>& buffer, uint8_t outputChannels);
+    friend QoiRowGenerator DecodeRows(QoiIStream& stream, uint8_t outputChannels);
+
+    std::coroutine_handle<promise_type> handle;
+    uint32_t width{0};
+    uint32_t height{0};
+    uint8_t channels{0};
+    uint8_t colorspace{0};
+    uint32_t rowIndex{0};
+};
+
+namespace Detail
+{
+
+template<uint8_t Channels>
+inline QoiRowGenerator DecodeRowsFromMemory(const uint8_t* data, const uint8_t* end, uint32_t width, uint32_t height)
+{
+    std::vector<uint8_t> row(static_cast<size_t>(width) * Channels);
+    DecoderState state;
+    for(uint32_t y = 0; y < height; y++)
+    {
+        data = DecodePixels<Channels>(state, data, end, row.data(), width);
+        co_yield std::span<const uint8_t>(row);
+    }
+}
+
+inline QoiRowGenerator DecodeRowsFromStream(QoiIStream& stream, uint32_t width, uint32_t height, uint8_t channels)
+{
+    std::vector<uint8_t> row(static_cast<size_t>(width) * channels);
+    for(uint32_t y = 0; y < height; y++)
+    {
+        for(size_t i = 0; i < row.size(); i += channels)
+        {
+            Rgba pixel = stream.Get();
+            row[i] = pixel.r;
+            row[i + 1] = pixel.g;
+            row[i + 2] = pixel.b;
+            if(channels == 4)
+                row[i + 3] = pixel.a;
+        }
+        co_yield std::span<const uint8_t>(row);
+    }
+}
+
+}
+
+/**
+  * @brief Lazily decodes a QOI file held in memory row by row.
+  * buffer must outlive the generator.
+  * @param outputChannels Channels of the produced rows, 0 keeps the file's.
+  * @return The row generator, invalid if the header is.
+  */
+inline QoiRowGenerator DecodeRows(const std::vector<uint8_t>& buffer, uint8_t outputChannels = 0)
+{
+    QoiRowGenerator generator;
+    if(buffer.size() < CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size() || !std::equal(CPPQOI_MAGIC.begin(), CPPQOI_MAGIC.end(), buffer.begin()))
+        return generator;
+
+    size_t position = CPPQOI_MAGIC.size();
+    uint32_t width = Utility::Read32(buffer, position);
+    uint32_t height = Utility::Read32(buffer, position);
+    uint8_t channels = buffer[position++];
+    uint8_t colorspace = buffer[position++];
+    if(channels < 3 || channels > 4 || colorspace > 1 || width == 0 || height == 0 || (outputChannels != 0 && (outputChannels < 3 || outputChannels > 4)))
+        return generator;
+    if(outputChannels != 0)
+        channels = outputChannels;
+
+    const uint8_t* end = buffer.data() + buffer.size() - CPPQOI_ENDTAG.size();
+    generator = channels == 4 ? Detail::DecodeRowsFromMemory<4>(buffer.data() + position, end, width, height) :
+                                Detail::DecodeRowsFromMemory<3>(buffer.data() + position, end, width, height);
+    generator.width = width;
+    generator.height = height;
+    generator.channels = channels;
+    generator.colorspace = colorspace;
+    return generator;
+}
+
+/**
+  * @brief Lazily decodes a QoiIStream row by row, reading only as much of the stream as the produced rows need.
+  * stream must outlive the generator.
+  * @param outputChannels Channels of the produced rows, 0 keeps the file's.
+  * @return The row generator, invalid if the stream is.
+  */
+inline QoiRowGenerator DecodeRows(QoiIStream& stream, uint8_t outputChannels = 0)
+{
+    QoiRowGenerator generator;
+    if(!stream.IsGood() || (outputChannels != 0 && (outputChannels < 3 || outputChannels > 4)))
+        return generator;
+
+    uint8_t channels = outputChannels != 0 ? outputChannels : static_cast<uint8_t>(stream.GetChannels());
+    generator = Detail::DecodeRowsFromStream(stream, stream.GetWidth(), stream.GetHeight(), channels);
+    generator.width = stream.GetWidth();
+    generator.height = stream.GetHeight();
+    generator.channels = channels;
+    generator.colorspace = stream.GetColorspace();
+    return generator;
+}
+#endif
+
+/**
+  * @brief Volume and timing of the last QoiBatchIO operation.
+  */
+struct QoiBatchStats
+{
+    size_t files{0}; /// files successfully processed
+    size_t failed{0}; /// files that failed to load or write
+    uint64_t bytes{0}; /// encoded bytes read or written
+    uint64_t pixels{0}; /// pixels decoded or encoded
+    double seconds{0.0}; /// latency of the whole batch
+
+    double FilesPerSecond(void) const
+    {
+        return seconds > 0.0 ? files / seconds : 0.0;
+    }
+
+    double MegabytesPerSecond(void) const
+    {
+        return seconds > 0.0 ? bytes / seconds / 1e6 : 0.0;
+    }
+};
+
+#ifdef CPPQOI_IO_URING
+namespace Detail
+{
+
+/**
+  * @brief Minimal io_uring submission/completion ring, driven through the raw syscalls.
+  */
+class IoUring
+{
+public:
+
+    IoUring() { }
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+    ~IoUring() { Destroy(); }
+
+    bool Create(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if(fd < 0)
+            return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if(singleMap)
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cqRing = singleMap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqesMap == MAP_FAILED)
+        {
+            sqes = sqesMap == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(sqesMap);
+            Destroy();
+            return false;
+        }
+        sqes = static_cast<io_uring_sqe*>(sqesMap);
+
+        uint8_t* sq = static_cast<uint8_t*>(sqRing);
+        uint8_t* cq = static_cast<uint8_t*>(cqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        sqEntries = params.sq_entries;
+        localTail = *sqTail;
+        submitted = localTail;
+        completed = 0;
+        return true;
+    }
+
+    /**
+      * @brief Queues a read or write of len bytes at offset.
+      * @return False if the submission queue is full.
+      */
+    bool Queue(uint8_t opcode, int file, void* data, unsigned len, uint64_t offset, uint64_t userData)
+    {
+        if(localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+            return false;
+        unsigned index = localTail & sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = file;
+        sqe->addr = reinterpret_cast<uint64_t>(data);
+        sqe->len = len;
+        sqe->off = offset;
+        sqe->user_data = userData;
+        sqArray[index] = index;
+        localTail++;
+        return true;
+    }
+
+    /**
+      * @brief Submits queued entries and waits until at least waitCount completions are available.
+      */
+    bool Submit(unsigned waitCount)
+    {
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+        unsigned toSubmit = localTail - submitted;
+        int result = static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, waitCount, waitCount ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+        if(result < 0)
+            return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+        submitted += static_cast<unsigned>(result);
+        return true;
+    }
+
+    /**
+      * @brief Takes the next completion, if any.
+      */
+    bool Complete(uint64_t& userData, int& result)
+    {
+        unsigned head = *cqHead;
+        if(head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            return false;
+        const io_uring_cqe& cqe = cqes[head & cqMask];
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        completed++;
+        return true;
+    }
+
+    /**
+      * @brief Takes back the queued entries that were not submitted yet, they are never started.
+      */
+    void Withdraw(void)
+    {
+        localTail = submitted;
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+    }
+
+    /**
+      * @brief Blocks until at least one completion is available, without submitting anything.
+      * @return False if the ring cannot be waited on.
+      */
+    bool Wait(void)
+    {
+        while(syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0)
+            if(errno != EINTR)
+                return false;
+        return true;
+    }
+
+    /**
+      * @return Number of submitted entries whose completion has not been taken yet.
+      */
+    unsigned GetPending(void) const
+    {
+        return submitted - completed;
+    }
+
+    void Destroy(void)
+    {
+        if(sqes != nullptr)
+            munmap(sqes, sqesSize);
+        if(cqRing != nullptr && cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if(sqRing != nullptr && sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if(fd >= 0)
+            close(fd);
+        sqes = nullptr;
+        sqRing = cqRing = nullptr;
+        fd = -1;
+    }
+
+private:
+
+    int fd{-1};
+    void* sqRing{nullptr};
+    void* cqRing{nullptr};
+    io_uring_sqe* sqes{nullptr};
+    size_t sqRingSize{0};
+    size_t cqRingSize{0};
+    size_t sqesSize{0};
+
+    unsigned* sqHead{nullptr};
+    unsigned* sqTail{nullptr};
+    unsigned* sqArray{nullptr};
+    unsigned sqMask{0};
+    unsigned sqEntries{0};
+    unsigned* cqHead{nullptr};
+    unsigned* cqTail{nullptr};
+    unsigned cqMask{0};
+    io_uring_cqe* cqes{nullptr};
+
+    unsigned localTail{0};
+    unsigned submitted{0};
+    unsigned completed{0};
+};
+
+}
+#endif
+
+/**
+  * @brief Loads and writes many QOI files at once.
+  * On Linux the file I/O of a batch is submitted through io_uring, every worker thread drives its
+  * own ring with its share of up to depth reads or writes in flight, and decodes or encodes files
+  * as their I/O completes. Where io_uring is unavailable a pool of threads each loads or writes
+  * files with blocking I/O.
+  */
+class QoiBatchIO
+{
+public:
+
+    /**
+      * @param depth Maximum number of file operations kept in flight.
+      * @param threadCount Worker threads, 0 uses the hardware concurrency. With io_uring at most depth of them are used.
+      */
+    QoiBatchIO(unsigned depth = 64, unsigned threadCount = 0) : queueDepth(std::max(1u, depth)), threads(threadCount)
+    {
+        if(threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+#ifdef CPPQOI_IO_URING
+        unsigned ringCount = std::min(threads, queueDepth);
+        useRing = true;
+        for(unsigned i = 0; i < ringCount && useRing; i++)
+        {
+            rings.push_back(std::make_unique<RingWorker>());
+            rings.back()->depth = queueDepth / ringCount;
+            useRing = rings.back()->ring.Create(rings.back()->depth);
+        }
+#endif
+    }
+
+    /**
+      * @brief Loads every file in filenames.
+      * @param files Receives the decoded images, in the order of filenames.
+      * @param success Receives per file whether it loaded.
+      * @return True if every file loaded.
+      */
+    bool Load(const std::vector<std::string>& filenames, std::vector<QoiFile>& files, std::vector<bool>& success)
+    {
+        auto start = std::chrono::steady_clock::now();
+        stats = QoiBatchStats();
+        files.assign(filenames.size(), QoiFile());
+        success.assign(filenames.size(), false);
+
+#ifdef CPPQOI_IO_URING
+        if(useRing)
+            RingTransfer(filenames, nullptr, files.data(), success);
+        else
+#endif
+            PoolTransfer(filenames, nullptr, files.data(), success);
+
+        return Finish(start, success);
+    }
+
+    /**
+      * @brief Encodes and writes every file in files to the matching entry of filenames.
+      * @param success Receives per file whether it was written.
+      * @return True if every file was written.
+      */
+    bool Write(const std::vector<std::string>& filenames, const std::vector<QoiFile>& files, std::vector<bool>& success)
+    {
+        auto start = std::chrono::steady_clock::now();
+        stats = QoiBatchStats();
+        success.assign(filenames.size(), false);
+        if(files.size() != filenames.size())
+            return false;
+
+#ifdef CPPQOI_IO_URING
+        if(useRing)
+            RingTransfer(filenames, files.data(), nullptr, success);
+        else
+#endif
+            PoolTransfer(filenames, files.data(), nullptr, success);
+
+        return Finish(start, success);
+    }
+
+    /**
+      * @brief Forces the blocking thread pool, mainly for benchmarking against io_uring.
+      */
+    void DisableIoUring(void)
+    {
+        useRing = false;
+    }
+
+    bool UsesIoUring(void) const
+    {
+        return useRing;
+    }
+
+    const QoiBatchStats& GetStats(void) const
+    {
+        return stats;
+    }
+
+private:
+
+    bool Finish(std::chrono::steady_clock::time_point start, const std::vector<bool>& success)
+    {
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        stats.failed = success.size() - stats.files;
+        return stats.failed == 0;
+    }
+
+    static void Count(QoiBatchStats& counts, uint64_t bytes, const QoiFile& qoi)
+    {
+        counts.files++;
+        counts.bytes += bytes;
+        counts.pixels += static_cast<uint64_t>(qoi.width) * qoi.height;
+    }
+
+    /**
+      * @brief Adds the counts of every worker to stats and marks the files they finished in success.
+      */
+    void Merge(const std::vector<QoiBatchStats>& local, const std::vector<char>& done, std::vector<bool>& success)
+    {
+        for(size_t i = 0; i < done.size(); i++)
+            success[i] = done[i] != 0;
+        for(const QoiBatchStats& s : local)
+        {
+            stats.files += s.files;
+            stats.bytes += s.bytes;
+            stats.pixels += s.pixels;
+        }
+    }
+
+    /**
+      * @brief Writes source to filenames if given, otherwise loads filenames into loaded.
+      * Files already marked in success are skipped.
+      */
+    void PoolTransfer(const std::vector<std::string>& filenames, const QoiFile* source, QoiFile* loaded, std::vector<bool>& success)
+    {
+        std::atomic<size_t> next{0};
+        std::vector<QoiBatchStats> local(threads);
+        std::vector<char> done(filenames.size(), 0);
+
+        auto worker = [&](unsigned id)
+        {
+            std::vector<uint8_t> buffer;
+            for(size_t i = next++; i < filenames.size(); i = next++)
+            {
+                //files finished by an aborted io_uring transfer are kept
+                if(success[i])
+                {
+                    done[i] = 1;
+                    continue;
+                }
+                const QoiFile& qoi = source ? source[i] : loaded[i];
+                if(source)
+                {
+                    std::ofstream stream(filenames[i].c_str(), std::ofstream::out | std::ofstream::binary);
+                    if(!stream.is_open() || !WriteQoi(qoi, buffer))
+                        continue;
+                    stream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+                    if(stream.bad())
+                        continue;
+                }
+                else
+                {
+                    std::ifstream stream(filenames[i].c_str(), std::ifstream::in | std::ifstream::binary);
+                    std::error_code ec;
+                    size_t size = std::filesystem::file_size(std::filesystem::path{filenames[i]}, ec);
+                    if(!stream.is_open() || ec)
+                        continue;
+                    buffer.resize(size);
+                    stream.read(reinterpret_cast<char*>(buffer.data()), size);
+                    if(!stream || !LoadQoi(loaded[i], buffer))
+                        continue;
+                }
+                done[i] = 1;
+                Count(local[id], buffer.size(), qoi);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for(unsigned i = 1; i < threads && i < filenames.size(); i++)
+            pool.emplace_back(worker, i);
+        worker(0);
+        for(std::thread& t : pool)
+            t.join();
+        Merge(local, done, success);
+    }
+
+#ifdef CPPQOI_IO_URING
+    struct Request
+    {
+        size_t index{0};
+        int fd{-1};
+        std::vector<uint8_t> buffer;
+        size_t done{0};
+    };
+
+    /**
+      * @brief A ring owned by one worker thread of RingTransfer.
+      */
+    struct RingWorker
+    {
+        std::vector<std::vector<uint8_t>> stranded; /// buffers of requests that could not be drained, must outlive ring
+        Detail::IoUring ring;
+        unsigned depth{1}; /// operations kept in flight on ring
+    };
+
+    static bool QueueRequest(Detail::IoUring& ring, unsigned slot, Request& request, bool write)
+    {
+        uint8_t* data = request.buffer.data() + request.done;
+        size_t remaining = request.buffer.size() - request.done;
+        unsigned len = static_cast<unsigned>(std::min<size_t>(remaining, 1u << 30));
+        return ring.Queue(write ? IORING_OP_WRITE : IORING_OP_READ, request.fd, data, len, request.done, slot);
+    }
+
+    void RingTransfer(const std::vector<std::string>& filenames, const QoiFile* source, QoiFile* loaded, std::vector<bool>& success)
+    {
+        //every worker takes files from next onto its own ring, so decoding and encoding run on all
+        //of them while their I/O is in flight
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        std::vector<QoiBatchStats> local(rings.size());
+        std::vector<char> done(filenames.size(), 0);
+
+        auto worker = [&](unsigned id)
+        {
+            if(!RingWorkerTransfer(*rings[id], filenames, source, loaded, next, done, local[id]))
+                failed = true;
+        };
+
+        std::vector<std::thread> pool;
+        for(unsigned i = 1; i < rings.size() && i < filenames.size(); i++)
+            pool.emplace_back(worker, i);
+        worker(0);
+        for(std::thread& t : pool)
+            t.join();
+        Merge(local, done, success);
+
+        //finish the files that did not complete on the thread pool, which is used from now on
+        if(failed)
+        {
+            useRing = false;
+            PoolTransfer(filenames, source, loaded, success);
+        }
+    }
+
+    /**
+      * @brief Transfers files taken from next through worker's ring until none are left.
+      * @return False if the ring failed, files it did not finish are left unmarked in done.
+      */
+    static bool RingWorkerTransfer(RingWorker& worker, const std::vector<std::string>& filenames, const QoiFile* source, QoiFile* loaded,
+                                   std::atomic<size_t>& next, std::vector<char>& done, QoiBatchStats& counts)
+    {
+        bool write = source != nullptr;
+        Detail::IoUring& ring = worker.ring;
+        std::vector<Request> requests(worker.depth);
+        std::vector<unsigned> freeSlots;
+        for(unsigned slot = worker.depth; slot > 0; slot--)
+            freeSlots.push_back(slot - 1);
+        bool more = true;
+
+        auto closeRequest = [](Request& request)
+        {
+            close(request.fd);
+            request.fd = -1;
+            std::vector<uint8_t>().swap(request.buffer);
+        };
+
+        while(more || freeSlots.size() < requests.size())
+        {
+            //open files and queue their I/O until the ring is full
+            while(more && !freeSlots.empty())
+            {
+                size_t i = next++;
+                if(i >= filenames.size())
+                {
+                    more = false;
+                    break;
+                }
+                Request& request = requests[freeSlots.back()];
+                request.index = i;
+                request.done = 0;
+                if(write)
+                {
+                    if(!WriteQoi(source[i], request.buffer))
+                        continue;
+                    request.fd = open(filenames[i].c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                }
+                else
+                {
+                    request.fd = open(filenames[i].c_str(), O_RDONLY | O_CLOEXEC);
+                    struct stat info;
+                    if(request.fd >= 0 && fstat(request.fd, &info) == 0)
+                        request.buffer.resize(static_cast<size_t>(info.st_size));
+                }
+                if(request.fd < 0)
+                    continue;
+                if(request.buffer.empty() || !QueueRequest(ring, freeSlots.back(), request, write))
+                {
+                    closeRequest(request);
+                    continue;
+                }
+                freeSlots.pop_back();
+            }
+
+            if(!ring.Submit(freeSlots.size() < requests.size() ? 1 : 0))
+                break;
+            Reap(ring, requests, freeSlots, source, loaded, done, counts, true);
+        }
+        if(!more && freeSlots.size() == requests.size())
+            return true;
+
+        //submission failed: the kernel may still write into the buffers of submitted requests,
+        //so wait for every one of them before anything is released
+        ring.Withdraw();
+        while(ring.GetPending() > 0 && ring.Wait())
+            Reap(ring, requests, freeSlots, source, loaded, done, counts, false);
+        if(ring.GetPending() > 0)
+        {
+            //the ring cannot be waited on, keep the buffers alive as long as the ring exists
+            for(Request& request : requests)
+                worker.stranded.push_back(std::move(request.buffer));
+        }
+        for(Request& request : requests)
+            if(request.fd >= 0)
+                close(request.fd);
+        return false;
+    }
+
+    /**
+      * @brief Decodes or releases every completed request, requeueing partial transfers if requeue is set.
+      * The slots of finished requests are returned to freeSlots.
+      */
+    static void Reap(Detail::IoUring& ring, std::vector<Request>& requests, std::vector<unsigned>& freeSlots, const QoiFile* source,
+                     QoiFile* loaded, std::vector<char>& done, QoiBatchStats& counts, bool requeue)
+    {
+        bool write = source != nullptr;
+        uint64_t userData;
+        int result;
+        while(ring.Complete(userData, result))
+        {
+            unsigned slot = static_cast<unsigned>(userData);
+            Request& request = requests[slot];
+            size_t i = request.index;
+            if(result > 0)
+                request.done += static_cast<size_t>(result);
+            if(result > 0 && request.done < request.buffer.size())
+            {
+                if(requeue && QueueRequest(ring, slot, request, write))
+                    continue;
+            }
+            else if(result > 0 && (write || LoadQoi(loaded[i], request.buffer)))
+            {
+                done[i] = 1;
+                Count(counts, request.buffer.size(), write ? source[i] : loaded[i]);
+            }
+            close(request.fd);
+            request.fd = -1;
+            std::vector<uint8_t>().swap(request.buffer);
+            freeSlots.push_back(slot);
+        }
+    }
+
+    std::vector<std::unique_ptr<RingWorker>> rings;
+#endif
+
+    unsigned queueDepth;
+    unsigned threads;
+    bool useRing{false};
+    QoiBatchStats stats;
+};
+
+
+/**
+  * @brief Content-addressed cache of encoded QOI data.
+  * Images are keyed by a 128 bit hash of their pixels plus the header fields, repeated encodes of
+  * identical images return the stored bytes instead of compressing again. Entries live in an LRU
+  * bounded by capacity bytes and, if a directory is given, are also stored on disk so they survive
+  * between processes. The cache may be shared between threads.
+  */
+class QoiEncodeCache
+{
+public:
+
+    struct Stats
+    {
+        uint64_t hits{0}; /// encodes answered from memory
+        uint64_t diskHits{0}; /// encodes answered from the on-disk store
+        uint64_t misses{0}; /// encodes that had to compress
+        uint64_t evictions{0}; /// entries dropped from memory to stay within capacity
+        size_t entries{0}; /// entries currently held in memory
+        size_t bytes{0}; /// encoded bytes currently held in memory
+    };
+
+    /**
+      * @param capacity Maximum encoded bytes kept in memory.
+      * @param dir Directory of the on-disk store, empty to keep entries in memory only.
+      */
+    QoiEncodeCache(size_t capacity = 256 * 1024 * 1024, const std::string& dir = "") : capacityBytes(capacity), directory(dir)
+    {
+        if(!directory.empty())
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(directory, ec);
+        }
+    }
+
+    /**
+      * @brief Encodes qoi into buffer, reusing a previous encode of the same image if possible.
+      * @return False if qoi is not a valid image.
+      */
+    bool Encode(const QoiFile& qoi, std::vector<uint8_t>& buffer)
+    {
+        Key key = MakeKey(qoi);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = index.find(key);
+            if(found != index.end())
+            {
+                entries.splice(entries.begin(), entries, found->second);
+                buffer = found->second->second;
+                stats.hits++;
+                return true;
+            }
+        }
+
+        if(LoadFromDisk(key, buffer))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.diskHits++;
+            Insert(key, buffer);
+            return true;
+        }
+
+        if(!WriteQoi(qoi, buffer))
+            return false;
+
+        SaveToDisk(key, buffer);
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.misses++;
+        Insert(key, buffer);
+        return true;
+    }
 
-    uint32_t GetWidth(void)
+    /**
+      * @brief Drops every entry held in memory, the on-disk store is kept.
+      */
+    void Clear(void)
     {
-        return width;
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        stats.entries = 0;
+        stats.bytes = 0;
     }
 
-    uint32_t GetHeight(void)
+    Stats GetStats(void) const
     {
-        return height;
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
     }
 
-    uint32_t GetChannels(void)
+private:
+
+    struct Key
     {
-        return channels;
+        std::array<uint64_t, 2> hash;
+        uint32_t width;
+        uint32_t height;
+        uint8_t channels;
+        uint8_t colorspace;
+
+        bool operator==(const Key& o) const
+        {
+            return hash == o.hash && width == o.width && height == o.height && channels == o.channels && colorspace == o.colorspace;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            return static_cast<size_t>(key.hash[0]);
+        }
+    };
+
+    typedef std::list<std::pair<Key, std::vector<uint8_t>>> EntryList;
+
+    static Key MakeKey(const QoiFile& qoi)
+    {
+        uint64_t seed = (static_cast<uint64_t>(qoi.width) << 32) ^ (static_cast<uint64_t>(qoi.height) << 16) ^ (qoi.channels << 8) ^ qoi.colorspace;
+        return {Utility::Hash128(qoi.pixelData.data(), qoi.pixelData.size(), seed), qoi.width, qoi.height, qoi.channels, qoi.colorspace};
     }
 
-    uint8_t GetColorspace(void)
+    void Insert(const Key& key, const std::vector<uint8_t>& buffer)
     {
-        return colorspace;
+        if(buffer.size() > capacityBytes || index.count(key))
+            return;
+        entries.emplace_front(key, buffer);
+        index[key] = entries.begin();
+        stats.entries++;
+        stats.bytes += buffer.size();
+
+        while(stats.bytes > capacityBytes)
+        {
+            stats.bytes -= entries.back().second.size();
+            stats.entries--;
+            stats.evictions++;
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
     }
 
-    bool IsGood(void)
+    std::filesystem::path DiskPath(const Key& key) const
     {
-        return stream != nullptr && stream->good();
+        static const char digits[] = "0123456789abcdef";
+        std::string name;
+        for(uint64_t part : key.hash)
+            for(int shift = 60; shift >= 0; shift -= 4)
+                name += digits[(part >> shift) & 0xf];
+        return std::filesystem::path(directory) / (name + ".qoi");
     }
 
-    uint32_t GetPixelIndex(void)
+    bool LoadFromDisk(const Key& key, std::vector<uint8_t>& buffer) const
     {
-        return pixelIndex;
+        if(directory.empty())
+            return false;
+        std::filesystem::path path = DiskPath(key);
+        std::ifstream stream(path, std::ifstream::in | std::ifstream::binary);
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(path, ec);
+        if(!stream.is_open() || ec || size < CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size() + CPPQOI_CHECKSUM_SIZE ||
+           size > QoiMaxSize(key.width, key.height, key.channels) + CPPQOI_CHECKSUM_SIZE)
+            return false;
+        buffer.resize(static_cast<size_t>(size));
+        stream.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+        //the name only covers the pixel hash, make sure the stored header matches as well
+        size_t position = CPPQOI_MAGIC.size();
+        if(!stream || !std::equal(CPPQOI_MAGIC.begin(), CPPQOI_MAGIC.end(), buffer.begin()) ||
+           Utility::Read32(buffer, position) != key.width || Utility::Read32(buffer, position) != key.height ||
+           buffer[position] != key.channels || buffer[position + 1] != key.colorspace)
+            return false;
+
+        //entries carry a checksum chunk, anything truncated or damaged is encoded again
+        size_t qoiSize = Utility::StripChecksum(buffer.data(), buffer.size());
+        position = qoiSize + CPPQOI_CHECKSUM_TAG.size();
+        if(qoiSize == buffer.size() || Utility::Read32(buffer, position) != Utility::Crc32c(0, buffer.data(), qoiSize))
+            return false;
+        buffer.resize(qoiSize);
+        return true;
     }
-private:
 
-    bool LoadHeader( std::istream& str)
+    void SaveToDisk(const Key& key, const std::vector<uint8_t>& buffer) const
     {
-        for(uint32_t i = 0; i < CPPQOI_MAGIC.size(); i++)
-            if(Utility::Read8(str) != CPPQOI_MAGIC[i])
-                return false;
-        width = Utility::Read32(str);
-        height = Utility::Read32(str);
-        channels = Utility::Read8(str);
-        colorspace = Utility::Read8(str);
-        return channels >= 3 && channels <= 4 && (colorspace == 0 || colorspace == 1) && width != 0 && height != 0 && str.good();
+        if(directory.empty())
+            return;
+        //write to a temporary unique across threads and processes and rename, so concurrent writers never expose a partial file
+        static const uint64_t token = (static_cast<uint64_t>(std::random_device()()) << 32) ^ std::random_device()();
+        static std::atomic<uint64_t> counter{0};
+        std::string unique = std::to_string(token) + "." + std::to_string(counter++);
+#if defined(CPPQOI_MMAP)
+        unique = std::to_string(getpid()) + "." + unique;
+#endif
+        std::filesystem::path path = DiskPath(key);
+        std::filesystem::path temp = path;
+        temp += "." + unique + ".tmp";
+        bool written;
+        {
+            std::array<uint8_t, CPPQOI_CHECKSUM_SIZE> chunk;
+            Detail::WriteChecksum(Utility::Crc32c(0, buffer.data(), buffer.size()), chunk.data());
+            std::ofstream stream(temp, std::ofstream::out | std::ofstream::binary);
+            stream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+            stream.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+            stream.close();
+            written = static_cast<bool>(stream);
+        }
+        std::error_code ec;
+        if(written)
+            std::filesystem::rename(temp, path, ec);
+        if(!written || ec)
+            std::filesystem::remove(temp, ec);
     }
 
-    std::array<Rgba, 64> seen;
-    Rgba pixel;
-    uint8_t run;
+    size_t capacityBytes;
+    std::string directory;
 
-    std::shared_ptr<std::istream> stream;
-    uint32_t width; /// width of the image (>0)
-    uint32_t height; /// height of the image (>0)
-    uint8_t channels; /// channels, 3=RGB, 4=RGBA
-    uint8_t colorspace; ///colorspace, 0 = sRGB, 1 = linear
-    uint32_t pixelIndex ;
+    mutable std::mutex mutex;
+    EntryList entries;
+    std::unordered_map<Key, EntryList::iterator, KeyHash> index;
+    Stats stats;
 };
 
-inline bool LoadQoi(QoiFile& qoi, const std::vector<uint8_t>& buffer)
+/**
+  * @brief Encodes qoi through cache, see QoiEncodeCache::Encode.
+  */
+inline bool WriteQoi(const QoiFile& qoi, std::vector<uint8_t>& buffer, QoiEncodeCache& cache)
 {
-    if(buffer.size() < CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size())
-        return false; //we can't even read in our header to verify it
+    return cache.Encode(qoi, buffer);
+}
 
+constexpr std::array<unsigned char, 4> CPPQOI_ARCHIVE_MAGIC{'q', 'o', 'i', 'a'}; /// Magic bytes of a QOI archive
+constexpr uint32_t CPPQOI_ARCHIVE_VERSION = 1; /// Archive layout written by QoiArchiveWriter
+constexpr size_t CPPQOI_ARCHIVE_HEADER_SIZE = 16; /// Magic, version, entry count and string table size
+constexpr size_t CPPQOI_ARCHIVE_ENTRY_SIZE = 32; /// Size of one fixed-size index entry
 
-    size_t position = 0;
-    for(size_t i = 0; i < CPPQOI_MAGIC.size(); i++)
-        if(buffer[position++] != CPPQOI_MAGIC[i])
+/**
+  * @brief Index entry of one image in a QoiArchive.
+  */
+struct QoiArchiveEntry
+{
+    std::string name;
+    uint64_t offset{0}; /// offset of the encoded QOI file from the start of the archive
+    uint32_t size{0}; /// size of the encoded QOI file in bytes
+    uint32_t width{0};
+    uint32_t height{0};
+    uint8_t channels{0};
+    uint8_t colorspace{0};
+};
+
+/**
+  * @brief Builds a QOI archive, a single file packing many encoded images behind a sorted index.
+  *
+  * Layout, all integers big-endian:
+  *     header      "qoia", version u32, entry count u32, string table size u32
+  *     index       per entry: name offset u32, name length u32, data offset u64, data size u32,
+  *                 width u32, height u32, channels u8, colorspace u8, reserved u16
+  *     strings     the entry names, concatenated without terminators
+  *     data        the complete encoded QOI files
+  * Index entries are sorted by name so readers can binary search the index in place.
+  */
+class QoiArchiveWriter
+{
+public:
+
+    /**
+      * @brief Encodes qoi and adds it under name.
+      * @return False if qoi is invalid or name is already taken.
+      */
+    bool Add(const std::string& name, const QoiFile& qoi, const QoiEncodeOptions& options = QoiEncodeOptions())
+    {
+        std::vector<uint8_t> buffer;
+        if(Contains(name) || !WriteQoi(qoi, buffer, options))
             return false;
+        return AddEncoded(name, std::move(buffer));
+    }
 
-    qoi.width = Utility::Read32(buffer, position);
-    qoi.height = Utility::Read32(buffer, position);
-    qoi.channels = buffer[position++];
-    qoi.colorspace = buffer[position++];
+    /**
+      * @brief Adds an already encoded QOI file under name.
+      * @return False if data does not start with a valid QOI header or name is already taken.
+      */
+    bool AddEncoded(const std::string& name, std::vector<uint8_t> data)
+    {
+        QoiArchiveEntry entry;
+        entry.name = name;
+        if(Contains(name) || data.size() < CPPQOI_HEADER_SIZE + CPPQOI_ENDTAG.size() || data.size() > UINT32_MAX ||
+           !std::equal(CPPQOI_MAGIC.begin(), CPPQOI_MAGIC.end(), data.begin()))
+            return false;
 
-    if(qoi.channels < 3 || qoi.channels > 4 || (qoi.colorspace != 0 && qoi.colorspace != 1) ||  qoi.width == 0 || qoi.height == 0)
-        return false;
+        size_t position = CPPQOI_MAGIC.size();
+        entry.width = Utility::Read32(data, position);
+        entry.height = Utility::Read32(data, position);
+        entry.channels = data[position++];
+        entry.colorspace = data[position++];
+        if(entry.width == 0 || entry.height == 0 || entry.channels < 3 || entry.channels > 4 || entry.colorspace > 1)
+            return false;
 
-    std::array<Rgba, 64> seen;
-    Rgba pixel(0, 0, 0, 255);
+        entry.size = static_cast<uint32_t>(data.size());
+        names.insert(name);
+        pending.push_back({std::move(entry), std::move(data)});
+        return true;
+    }
+
+    /**
+      * @brief Adds the QOI file at path under name, its bytes are copied as they are.
+      */
+    bool AddFile(const std::string& name, const std::string& path)
+    {
+        std::ifstream stream(path.c_str(), std::ifstream::in | std::ifstream::binary);
+        std::error_code ec;
+        size_t size = std::filesystem::file_size(std::filesystem::path{path}, ec);
+        if(!stream.is_open() || ec)
+            return false;
+        std::vector<uint8_t> data(size);
+        stream.read(reinterpret_cast<char*>(data.data()), size);
+        return stream && AddEncoded(name, std::move(data));
+    }
 
-    size_t pixelPosition = 0;
-    qoi.pixelData.resize(qoi.width * qoi.height * qoi.channels);
+    size_t GetEntryCount(void) const
+    {
+        return pending.size();
+    }
 
-    while(pixelPosition < qoi.pixelData.size())
+    /**
+      * @brief Writes the archive to filename.
+      */
+    bool Write(const std::string& filename)
     {
-        if(position < (buffer.size() - CPPQOI_ENDTAG.size()))
+        std::sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) { return a.entry.name < b.entry.name; });
+
+        uint64_t stringSize = 0;
+        for(const Pending& p : pending)
+            stringSize += p.entry.name.size();
+        if(pending.size() > UINT32_MAX || stringSize > UINT32_MAX)
+            return false;
+
+        std::vector<uint8_t> head(CPPQOI_ARCHIVE_HEADER_SIZE + pending.size() * CPPQOI_ARCHIVE_ENTRY_SIZE + stringSize);
+        std::copy(CPPQOI_ARCHIVE_MAGIC.begin(), CPPQOI_ARCHIVE_MAGIC.end(), head.begin());
+        size_t position = CPPQOI_ARCHIVE_MAGIC.size();
+        Utility::Write32(head, CPPQOI_ARCHIVE_VERSION, position);
+        Utility::Write32(head, static_cast<uint32_t>(pending.size()), position);
+        Utility::Write32(head, static_cast<uint32_t>(stringSize), position);
+
+        size_t stringPosition = CPPQOI_ARCHIVE_HEADER_SIZE + pending.size() * CPPQOI_ARCHIVE_ENTRY_SIZE;
+        uint64_t nameOffset = 0;
+        uint64_t dataOffset = head.size();
+        for(Pending& p : pending)
         {
-            uint8_t tag = buffer[position++];
-            if(tag == CPPQOI_OP_RGB || tag == CPPQOI_OP_RGBA) //this is just flat loading the pixel
-            {
-                uint8_t r = buffer[position++];
-                uint8_t g = buffer[position++];
-                uint8_t b = buffer[position++];
-                uint8_t a = (tag == CPPQOI_OP_RGBA) ? buffer[position++] : pixel.a;
-                pixel = Rgba(r, g, b, a);
-            }
-            else
-            {
-                uint8_t tagOp = (tag & 0b11000000);
-                uint8_t tagOperand = (tag & 0b00111111);
-                if(tagOp == CPPQOI_OP_INDEX) // 00
-                    pixel = seen[tagOperand];
-                else if(tagOp == CPPQOI_OP_DIFF) // 01
-                {
-                    pixel.r += static_cast<uint8_t>( (((tagOperand & 0b110000) >> 4U) & 0x3) - 2);
-                    pixel.g += static_cast<uint8_t>( (((tagOperand & 0b001100) >> 2U) & 0x3) - 2);
-                    pixel.b += static_cast<uint8_t>( (((tagOperand & 0b000011) >> 0U) & 0x3) - 2);
-                }
-                else if(tagOp == CPPQOI_OP_LUMA) // 10
-                {
-                    uint8_t l = buffer[position++];
-                    const uint8_t dg = static_cast<uint8_t>( static_cast<unsigned>(tagOperand) - 32);
+            p.entry.offset = dataOffset;
+            Utility::Write32(head, static_cast<uint32_t>(nameOffset), position);
+            Utility::Write32(head, static_cast<uint32_t>(p.entry.name.size()), position);
+            Utility::Write32(head, static_cast<uint32_t>(dataOffset >> 32), position);
+            Utility::Write32(head, static_cast<uint32_t>(dataOffset), position);
+            Utility::Write32(head, p.entry.size, position);
+            Utility::Write32(head, p.entry.width, position);
+            Utility::Write32(head, p.entry.height, position);
+            head[position++] = p.entry.channels;
+            head[position++] = p.entry.colorspace;
+            head[position++] = 0;
+            head[position++] = 0;
 
-                    pixel.r += (dg - 8 + static_cast<uint8_t>((l >> 4U)) && 0b00001111U);
-                    pixel.g += dg;
-                    pixel.b += (dg - 8 + static_cast<uint8_t>((l >> 0U)) && 0b00001111U);
-                }
-                else if(tagOp == CPPQOI_OP_RUN) // 11
-                    for(uint8_t k = 0; k < tagOperand; k++)
-                    {
-                        qoi.pixelData[pixelPosition++] = pixel.r;
-                        qoi.pixelData[pixelPosition++] = pixel.g;
-                        qoi.pixelData[pixelPosition++] = pixel.b;
-                        if(qoi.channels == 4)
-                            qoi.pixelData[pixelPosition++] = pixel.a;
-                    }
-            }
-            seen[HashPixel(pixel) % 64] = pixel;
+            std::copy(p.entry.name.begin(), p.entry.name.end(), head.begin() + stringPosition + nameOffset);
+            nameOffset += p.entry.name.size();
+            dataOffset += p.entry.size;
         }
 
-        qoi.pixelData[pixelPosition++] = pixel.r;
-        qoi.pixelData[pixelPosition++] = pixel.g;
-        qoi.pixelData[pixelPosition++] = pixel.b;
-        if(qoi.channels == 4)
-            qoi.pixelData[pixelPosition++] = pixel.a;
+        std::ofstream stream(filename.c_str(), std::ofstream::out | std::ofstream::binary);
+        if(!stream.is_open())
+            return false;
+        stream.write(reinterpret_cast<const char*>(head.data()), head.size());
+        for(const Pending& p : pending)
+            stream.write(reinterpret_cast<const char*>(p.data.data()), p.data.size());
+        return !stream.bad();
     }
 
-    return true;
-}
+private:
 
-inline bool IsQoi(std::istream& stream)
-{
-    size_t pos = stream.tellg();
-    bool returnV = true;
-    for(uint32_t i = 0; i < CPPQOI_MAGIC.size(); i++)
-        returnV = returnV && CPPQOI_MAGIC[i] == Utility::Read8(stream);
-    stream.seekg(pos);
-    return returnV;
-}
+    struct Pending
+    {
+        QoiArchiveEntry entry;
+        std::vector<uint8_t> data;
+    };
 
-inline bool LoadQoi(std::istream& stream, QoiFile& qoi, size_t dataCount)
-{
-    std::vector<uint8_t> buffer(dataCount);
-    stream.read(reinterpret_cast<char*>(buffer.data()), dataCount);
-    return LoadQoi(qoi, buffer);
-}
+    bool Contains(const std::string& name) const
+    {
+        return names.count(name) != 0;
+    }
 
-inline bool LoadQoi(const std::string& filename, QoiFile& qoi)
-{
-    std::ifstream stream(filename.c_str(), std::ifstream::in | std::ifstream::binary);
-    if(!stream.is_open())
-        return false;
-    return LoadQoi(stream, qoi, std::filesystem::file_size(std::filesystem::path{filename}));
-}
+    std::vector<Pending> pending;
+    std::set<std::string> names;
+};
 
-inline bool WriteQoi(const QoiFile& qoi, std::vector<uint8_t>& buffer)
+/**
+  * @brief Read access to an archive written by QoiArchiveWriter.
+  * The archive is opened once and memory mapped where available, otherwise read into memory.
+  * Opening only checks the header, the index is binary searched in place and images are decoded
+  * lazily on Load. Const member functions may be called from several threads at once.
+  */
+class QoiArchive
 {
-    size_t pixelCount = qoi.width * qoi.height * qoi.channels;
-    if(qoi.width == 0 || qoi.height == 0 || qoi.pixelData.size() != qoi.width * qoi.height * qoi.channels || qoi.channels < 3 || qoi.channels > 4 || qoi.colorspace > 1)
-        return false;
-
-    size_t bufferSize = qoi.width * qoi.height * (qoi.channels + 1) + CPPQOI_HEADER_SIZE + sizeof(CPPQOI_ENDTAG);
-    buffer.resize(bufferSize);
-    std::array<Rgba,64> seen;
-
-    size_t position = 0;
-    Rgba lastPixel(0, 0, 0, 255);
-    Rgba pixel(0, 0, 0,255);
+public:
 
-    //Write the header
+    QoiArchive() = default;
 
-    for(size_t i = 0; i < CPPQOI_MAGIC.size(); i++)
-        buffer[position++] = CPPQOI_MAGIC[i];
+    QoiArchive(const std::string& filename)
+    {
+        Open(filename);
+    }
 
-    Utility::Write32(buffer, qoi.width, position);
-    Utility::Write32(buffer, qoi.height, position);
-    buffer[position++] = qoi.channels;
-    buffer[position++] = qoi.colorspace;
+    QoiArchive(const QoiArchive&) = delete;
+    QoiArchive& operator=(const QoiArchive&) = delete;
 
-    uint8_t run = 0;
-    for(size_t i = 0; i < pixelCount; i += qoi.channels)
+    ~QoiArchive()
     {
-        pixel.r = qoi.pixelData[i];
-        pixel.g = qoi.pixelData[i + 1];
-        pixel.b = qoi.pixelData[i + 2];
-
-        if(qoi.channels > 3)
-            pixel.a = qoi.pixelData[i + 3];
+        Close();
+    }
 
-        if(lastPixel == pixel)
+    /**
+      * @brief Opens the archive at filename, closing any archive opened before.
+      */
+    bool Open(const std::string& filename)
+    {
+        Close();
+#ifdef CPPQOI_MMAP
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat info;
+        if(fstat(fd, &info) == 0 && info.st_size > 0)
         {
-            run++;
-            if(run == 62 || i == pixelCount - qoi.channels) //we are too far into a run or simply at the end of the file
+            void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            if(mapped != MAP_FAILED)
             {
-                buffer[position++] = static_cast<uint8_t>(CPPQOI_OP_RUN | (run - 1));
-                run = 0;
+                data = static_cast<const uint8_t*>(mapped);
+                size = static_cast<size_t>(info.st_size);
+                mappedSize = size;
             }
         }
-        else
+        ::close(fd);
+#else
+        std::ifstream stream(filename.c_str(), std::ifstream::in | std::ifstream::binary);
+        std::error_code ec;
+        size_t fileSize = std::filesystem::file_size(std::filesystem::path{filename}, ec);
+        if(stream.is_open() && !ec)
         {
-            if(run > 0) //we encountered a different pixel during a run, end the run we had going
+            storage.resize(fileSize);
+            stream.read(reinterpret_cast<char*>(storage.data()), fileSize);
+            if(stream)
             {
-                buffer[position++] = static_cast<uint8_t>(CPPQOI_OP_RUN | (run - 1));
-                run = 0;
+                data = storage.data();
+                size = storage.size();
             }
+        }
+#endif
+        if(!data || !ReadHeader())
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
 
-            uint8_t pixelHash = static_cast<uint8_t>(HashPixel(pixel) % 64);
+    void Close(void)
+    {
+#ifdef CPPQOI_MMAP
+        if(mappedSize)
+            munmap(const_cast<uint8_t*>(data), mappedSize);
+        mappedSize = 0;
+#else
+        storage.clear();
+        storage.shrink_to_fit();
+#endif
+        data = nullptr;
+        size = 0;
+        entryCount = 0;
+        stringTable = 0;
+    }
 
-            if(seen[pixelHash] == pixel)
-                buffer[position++] = CPPQOI_OP_INDEX | pixelHash;
-            else
-            {
-                seen[pixelHash] = pixel;
+    bool IsOpen(void) const
+    {
+        return data != nullptr;
+    }
 
-                if(pixel.a == lastPixel.a)
-                {
-                    int8_t dr = static_cast<int8_t>(pixel.r - lastPixel.r);
-                    int8_t dg = static_cast<int8_t>(pixel.g - lastPixel.g);
-                    int8_t db = static_cast<int8_t>(pixel.b - lastPixel.b);
-
-                    int8_t dgr = dr - dg;
-                    int8_t dgb = db - dg;
-
-                    if(dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2)
-                        buffer[position++] = CPPQOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
-                    else if(dgr > -9 && dgr < 8 && dg > -33 && dg < 32 && dgb > -9 && dgb < 8)
-                    {
-                        buffer[position++] = CPPQOI_OP_LUMA | (dg + 32);
-                        buffer[position++] = (dgr + 8 ) << 4 | (dgb + 8);
-                    }
-                    else
-                    {
-                        buffer[position++] = CPPQOI_OP_RGB;
-                        buffer[position++] = pixel.r;
-                        buffer[position++] = pixel.g;
-                        buffer[position++] = pixel.b;
-                    }
-                }
-                else
-                {
-                    buffer[position++] = CPPQOI_OP_RGBA;
-                    buffer[position++] = pixel.r;
-                    buffer[position++] = pixel.g;
-                    buffer[position++] = pixel.b;
-                    buffer[position++] = pixel.a;
-                }
+    size_t GetEntryCount(void) const
+    {
+        return entryCount;
+    }
+
+    /**
+      * @brief Looks up the index of the entry called name.
+      */
+    bool Find(const std::string& name, size_t& index) const
+    {
+        size_t low = 0;
+        size_t high = entryCount;
+        while(low < high)
+        {
+            size_t middle = low + (high - low) / 2;
+            const uint8_t* nameData;
+            size_t nameSize;
+            if(!GetName(middle, nameData, nameSize))
+                return false;
+            int order = std::memcmp(nameData, name.data(), std::min(nameSize, name.size()));
+            if(order == 0)
+                order = nameSize < name.size() ? -1 : (nameSize > name.size() ? 1 : 0);
+            if(order == 0)
+            {
+                index = middle;
+                return true;
             }
+            if(order < 0)
+                low = middle + 1;
+            else
+                high = middle;
         }
-        lastPixel = pixel;
+        return false;
     }
 
-    for(size_t i = 0; i < CPPQOI_ENDTAG.size(); i++)
-        buffer[position++] = CPPQOI_ENDTAG[i];
-    buffer.resize(position);
-    return true;
-}
+    /**
+      * @brief Reads the index entry at index without decoding the image.
+      */
+    bool GetEntry(size_t index, QoiArchiveEntry& entry) const
+    {
+        const uint8_t* nameData;
+        size_t nameSize;
+        if(!GetName(index, nameData, nameSize))
+            return false;
+        size_t position = EntryPosition(index) + 8;
+        uint64_t offset = static_cast<uint64_t>(Utility::Read32(data, position)) << 32;
+        offset |= Utility::Read32(data, position);
+        entry.name.assign(reinterpret_cast<const char*>(nameData), nameSize);
+        entry.offset = offset;
+        entry.size = Utility::Read32(data, position);
+        entry.width = Utility::Read32(data, position);
+        entry.height = Utility::Read32(data, position);
+        entry.channels = data[position++];
+        entry.colorspace = data[position++];
+        return entry.offset <= size && entry.size <= size - entry.offset;
+    }
 
+    /**
+      * @brief Gives access to the encoded QOI file of an entry, valid until the archive is closed.
+      */
+    bool GetData(size_t index, const uint8_t*& encoded, size_t& encodedSize) const
+    {
+        QoiArchiveEntry entry;
+        if(!GetEntry(index, entry))
+            return false;
+        encoded = data + entry.offset;
+        encodedSize = entry.size;
+        return true;
+    }
 
-inline bool WriteQoi(std::ostream& out, const QoiFile& qoi)
-{
-    std::vector<uint8_t> buffer;
-    if(!WriteQoi(qoi, buffer))
-        return false;
-    out.write( reinterpret_cast<char*>(buffer.data()), buffer.size());
-    return !out.bad();
-}
+    /**
+      * @brief Decodes the entry at index into qoi.
+      */
+    bool Load(size_t index, QoiFile& qoi, const QoiDecodeOptions& options = QoiDecodeOptions()) const
+    {
+        const uint8_t* encoded;
+        size_t encodedSize;
+        return GetData(index, encoded, encodedSize) && LoadQoi(qoi, encoded, encodedSize, options);
+    }
 
-inline bool WriteQoi(const std::string& filename, const QoiFile& qoi)
-{
-    std::ofstream stream(filename.c_str(), std::ofstream::out | std::ofstream::binary);
-    if(!stream.is_open())
-        return false;
-    return WriteQoi(stream, qoi);
-}
+    /**
+      * @brief Decodes the entry called name into qoi.
+      */
+    bool Load(const std::string& name, QoiFile& qoi, const QoiDecodeOptions& options = QoiDecodeOptions()) const
+    {
+        size_t index;
+        return Find(name, index) && Load(index, qoi, options);
+    }
+
+    /**
+      * @brief Decodes the named entries on a pool of threads.
+      * @param files Receives the decoded images, in the order of names.
+      * @param success Receives per name whether it was found and decoded.
+      * @param threadCount Number of threads, 0 uses the hardware concurrency.
+      * @return True if every entry loaded.
+      */
+    bool LoadParallel(const std::vector<std::string>& names, std::vector<QoiFile>& files, std::vector<bool>& success,
+                      unsigned threadCount = 0, const QoiDecodeOptions& options = QoiDecodeOptions()) const
+    {
+        files.assign(names.size(), QoiFile());
+        std::vector<char> done(names.size(), 0);
+        std::atomic<size_t> next{0};
+        auto worker = [&]()
+        {
+            for(size_t i = next++; i < names.size(); i = next++)
+                done[i] = Load(names[i], files[i], options) ? 1 : 0;
+        };
+        RunThreads(threadCount, names.size(), worker);
+
+        success.assign(names.size(), false);
+        bool all = true;
+        for(size_t i = 0; i < done.size(); i++)
+        {
+            success[i] = done[i] != 0;
+            all = all && success[i];
+        }
+        return all;
+    }
+
+    /**
+      * @brief Faults the whole archive into memory ahead of use.
+      * Mapped pages are requested from the kernel and touched by a pool of threads, so later
+      * Load calls do not stall on disk reads. Without a mapping the data is already in memory.
+      * @param threadCount Number of threads, 0 uses the hardware concurrency.
+      */
+    void Prefetch(unsigned threadCount = 0) const
+    {
+#ifdef CPPQOI_MMAP
+        if(!mappedSize)
+            return;
+        madvise(const_cast<uint8_t*>(data), mappedSize, MADV_WILLNEED);
+
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t block = 256 * page;
+        const size_t blocks = (mappedSize + block - 1) / block;
+        std::atomic<size_t> next{0};
+        auto worker = [&]()
+        {
+            volatile uint8_t sink = 0;
+            for(size_t i = next++; i < blocks; i = next++)
+                for(size_t offset = i * block; offset < std::min(mappedSize, (i + 1) * block); offset += page)
+                    sink = sink + data[offset];
+        };
+        RunThreads(threadCount, blocks, worker);
+#else
+        (void)threadCount;
+#endif
+    }
+
+private:
+
+    template<typename Worker>
+    static void RunThreads(unsigned threadCount, size_t jobs, Worker& worker)
+    {
+        if(threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<std::thread> pool;
+        for(unsigned i = 1; i < threadCount && i < jobs; i++)
+            pool.emplace_back([&worker]() { worker(); });
+        worker();
+        for(std::thread& t : pool)
+            t.join();
+    }
+
+    bool ReadHeader(void)
+    {
+        if(size < CPPQOI_ARCHIVE_HEADER_SIZE || !std::equal(CPPQOI_ARCHIVE_MAGIC.begin(), CPPQOI_ARCHIVE_MAGIC.end(), data))
+            return false;
+        size_t position = CPPQOI_ARCHIVE_MAGIC.size();
+        uint32_t version = Utility::Read32(data, position);
+        uint64_t count = Utility::Read32(data, position);
+        uint64_t stringSize = Utility::Read32(data, position);
+        uint64_t indexEnd = CPPQOI_ARCHIVE_HEADER_SIZE + count * CPPQOI_ARCHIVE_ENTRY_SIZE;
+        if(version != CPPQOI_ARCHIVE_VERSION || indexEnd + stringSize > size)
+            return false;
+        entryCount = static_cast<size_t>(count);
+        stringTable = static_cast<size_t>(indexEnd);
+        stringTableSize = static_cast<size_t>(stringSize);
+        return true;
+    }
+
+    size_t EntryPosition(size_t index) const
+    {
+        return CPPQOI_ARCHIVE_HEADER_SIZE + index * CPPQOI_ARCHIVE_ENTRY_SIZE;
+    }
+
+    bool GetName(size_t index, const uint8_t*& nameData, size_t& nameSize) const
+    {
+        if(index >= entryCount)
+            return false;
+        size_t position = EntryPosition(index);
+        size_t offset = Utility::Read32(data, position);
+        nameSize = Utility::Read32(data, position);
+        if(offset > stringTableSize || nameSize > stringTableSize - offset)
+            return false;
+        nameData = data + stringTable + offset;
+        return true;
+    }
 
+    const uint8_t* data{nullptr};
+    size_t size{0};
+    size_t entryCount{0};
+    size_t stringTable{0};
+    size_t stringTableSize{0};
+#ifdef CPPQOI_MMAP
+    size_t mappedSize{0};
+#else
+    std::vector<uint8_t> storage;
+#endif
+};
 
 }
 
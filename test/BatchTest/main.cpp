@@ -0,0 +1,80 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <cppqoi.hpp>
+#include "../QOIBMP/Batch.h"
+#include "../QOIBMP/Bitmap.h"
+
+/*
+    Batch conversion test, built together with QOIBMP's Batch.cpp and Bitmap.cpp.
+
+    Usage is BatchTest [workDir]
+    Converts a directory holding a valid and a truncated bitmap twice and checks
+    that the truncated one fails both times without leaving an output behind,
+    while the valid one is converted once and then skipped as up to date.
+    Then adds a .bmp and a .png of the same name and checks that both fail
+    instead of racing for the same output.
+*/
+
+bool Fail(const std::string& message)
+{
+    std::cout <<"FAIL " <<message <<"\n";
+    return false;
+}
+
+int main(int argc, char* argv[])
+{
+    std::filesystem::path work = argc > 1 ? std::filesystem::path(argv[1]) : std::filesystem::temp_directory_path() / "cppqoi_batchtest";
+    std::filesystem::path source = work / "source", dest = work / "dest";
+    std::error_code ec;
+    std::filesystem::remove_all(work, ec);
+    std::filesystem::create_directories(source);
+
+    Bitmap bitmap(64, 64);
+    for(uint32_t y = 0; y < 64; y++)
+        for(uint32_t x = 0; x < 64; x++)
+            bitmap.SetPixel(x, y, static_cast<uint8_t>(x * 4), static_cast<uint8_t>(y * 4), 128);
+    if(!bitmap.SaveBMP((source / "valid.bmp").string()))
+    {
+        Fail("could not write valid.bmp");
+        return 1;
+    }
+
+    //the same file cut off in the middle of its pixel data
+    std::ifstream valid(source / "valid.bmp", std::ifstream::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(valid)), std::istreambuf_iterator<char>());
+    std::ofstream(source / "truncated.bmp", std::ofstream::binary).write(data.data(), data.size() / 2);
+
+    bool success = true;
+    for(int run = 0; run < 2; run++)
+    {
+        BatchStats stats;
+        std::string name = "run " + std::to_string(run + 1) + ": ";
+        if(ConvertDirectory(source.string(), dest.string(), 1, stats))
+            success = Fail(name + "truncated input was not reported");
+        if(stats.failed != 1)
+            success = Fail(name + std::to_string(stats.failed) + " failed files, expected the truncated one");
+        if(stats.files != (run == 0 ? 1u : 0u) || stats.skipped != (run == 0 ? 0u : 1u))
+            success = Fail(name + "valid input converted " + std::to_string(stats.files) + " times, skipped " + std::to_string(stats.skipped));
+        if(std::filesystem::exists(dest / "truncated.qoi") || std::filesystem::exists(dest / "truncated.qoi.tmp"))
+            success = Fail(name + "output of the truncated input was left behind");
+    }
+
+    //same.bmp and same.png would both be encoded to same.qoi
+    if(!bitmap.SaveBMP((source / "same.bmp").string()) || !bitmap.SavePNG((source / "same.png").string()))
+        success = Fail("could not write same.bmp and same.png");
+    BatchStats stats;
+    ConvertDirectory(source.string(), dest.string(), 2, stats);
+    if(stats.failed != 3 || stats.files != 0 || stats.skipped != 1)
+        success = Fail("duplicate outputs: " + std::to_string(stats.failed) + " failed, " + std::to_string(stats.files) + " converted, expected 3 and 0");
+    if(std::filesystem::exists(dest / "same.qoi") || std::filesystem::exists(dest / "same.qoi.tmp"))
+        success = Fail("duplicate outputs: same.qoi was written");
+
+    cppqoi::QoiFile qoi;
+    if(!cppqoi::LoadQoi((dest / "valid.qoi").string(), qoi) || qoi.width != 64 || qoi.height != 64)
+        success = Fail("valid.qoi does not hold the 64x64 image");
+
+    std::filesystem::remove_all(work, ec);
+    std::cout <<(success ? "batch test passed\n" : "batch test failed\n");
+    return success ? 0 : 1;
+}
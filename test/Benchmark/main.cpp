@@ -0,0 +1,178 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <random>
+#include <cppqoi.hpp>
+
+/*
+    Encoder benchmark, reports speed, size and quality of every encoder configuration.
+
+    Usage is Benchmark [repetitions] [file.qoi ...]
+    Without files a set of synthetic images is used.
+    CPPQOI_KERNEL_TIER=baseline|sse4.2|avx2|avx512 forces a lower kernel tier than the CPU supports.
+*/
+
+struct Config
+{
+    std::string name;
+    cppqoi::QoiEncodeOptions options;
+};
+
+std::vector<Config> Configs()
+{
+    std::vector<Config> configs;
+    configs.push_back({"balanced", cppqoi::QoiEncodeOptions()});
+
+    Config fastest{"fastest", cppqoi::QoiEncodeOptions()};
+    fastest.options.preset = cppqoi::QoiPreset::Fastest;
+    configs.push_back(fastest);
+
+    Config checksum{"balanced+crc32c", cppqoi::QoiEncodeOptions()};
+    checksum.options.checksum = true;
+    configs.push_back(checksum);
+
+    for(uint8_t error : {1, 2, 4, 8})
+    {
+        Config config{"near-lossless " + std::to_string(error), cppqoi::QoiEncodeOptions()};
+        config.options.maxError = {error, error, error, error};
+        configs.push_back(config);
+    }
+    return configs;
+}
+
+/**
+  * @brief A noisy photo-like RGB image, smooth gradients with sensor noise on top.
+  */
+cppqoi::QoiFile Photo(uint32_t width, uint32_t height)
+{
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 3.0f);
+    cppqoi::QoiFile qoi{std::vector<uint8_t>(static_cast<size_t>(width) * height * 3), width, height, 3, 0};
+    size_t i = 0;
+    for(uint32_t y = 0; y < height; y++)
+        for(uint32_t x = 0; x < width; x++)
+        {
+            float base[3] = {128.0f + 100.0f * std::sin(x * 0.01f), 128.0f + 100.0f * std::cos(y * 0.013f), 64.0f + 0.1f * ((x + y) % 1280)};
+            for(float channel : base)
+                qoi.pixelData[i++] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, channel + noise(rng))));
+        }
+    return qoi;
+}
+
+/**
+  * @brief A user interface like RGBA image, flat panels with sharp edges and translucent shadows.
+  */
+cppqoi::QoiFile Interface(uint32_t width, uint32_t height)
+{
+    cppqoi::QoiFile qoi{std::vector<uint8_t>(static_cast<size_t>(width) * height * 4), width, height, 4, 0};
+    size_t i = 0;
+    for(uint32_t y = 0; y < height; y++)
+        for(uint32_t x = 0; x < width; x++)
+        {
+            bool panel = (x / 64 + y / 48) % 3 == 0;
+            bool text = panel && (x * 7 + y * 3) % 11 < 2;
+            bool shadow = !panel && x % 64 < 6;
+            qoi.pixelData[i++] = text ? 20 : (panel ? 230 : 60);
+            qoi.pixelData[i++] = text ? 20 : (panel ? 230 : 70);
+            qoi.pixelData[i++] = text ? 20 : (panel ? 240 : 90);
+            qoi.pixelData[i++] = shadow ? static_cast<uint8_t>(40 * (x % 64)) : 255;
+        }
+    return qoi;
+}
+
+double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+  * @brief Peak signal to noise ratio in dB, infinite for identical images.
+  */
+double Psnr(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b)
+{
+    double sum = 0.0;
+    for(size_t i = 0; i < a.size(); i++)
+        sum += (static_cast<double>(a[i]) - b[i]) * (static_cast<double>(a[i]) - b[i]);
+    if(sum == 0.0)
+        return INFINITY;
+    return 10.0 * std::log10(255.0 * 255.0 / (sum / a.size()));
+}
+
+void Run(const std::string& name, const cppqoi::QoiFile& qoi, unsigned repetitions)
+{
+    double megapixels = static_cast<double>(qoi.width) * qoi.height / 1e6;
+    std::cout <<name <<" " <<qoi.width <<"x" <<qoi.height <<"x" <<static_cast<int>(qoi.channels) <<"\n";
+
+    for(const Config& config : Configs())
+    {
+        std::vector<uint8_t> encoded;
+        auto start = std::chrono::steady_clock::now();
+        for(unsigned i = 0; i < repetitions; i++)
+            cppqoi::WriteQoi(qoi, encoded, config.options);
+        double encodeTime = Seconds(start) / repetitions;
+
+        cppqoi::QoiFile decoded;
+        cppqoi::QoiDecodeOptions decodeOptions;
+        decodeOptions.channels = qoi.channels;
+        decodeOptions.verifyChecksum = config.options.checksum;
+        start = std::chrono::steady_clock::now();
+        for(unsigned i = 0; i < repetitions; i++)
+            cppqoi::LoadQoi(decoded, encoded, decodeOptions);
+        double decodeTime = Seconds(start) / repetitions;
+
+        std::cout <<"  " <<std::left <<std::setw(18) <<config.name <<std::right <<std::fixed <<std::setprecision(1)
+                  <<" encode " <<std::setw(7) <<megapixels / encodeTime <<" MP/s"
+                  <<"  decode " <<std::setw(7) <<megapixels / decodeTime <<" MP/s"
+                  <<"  size " <<std::setw(9) <<encoded.size()
+                  <<std::setprecision(2) <<"  " <<std::setw(5) <<encoded.size() * 8.0 / (megapixels * 1e6) <<" bpp"
+                  <<"  psnr " <<std::setw(6) <<Psnr(qoi.pixelData, decoded.pixelData) <<" dB\n";
+    }
+
+    std::vector<uint8_t> encoded;
+    cppqoi::WriteQoi(qoi, encoded);
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    cppqoi::QoiFile decoded;
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned i = 0; i < repetitions; i++)
+        cppqoi::LoadQoiParallel(decoded, encoded, cppqoi::QoiDecodeOptions(), threads);
+    double decodeTime = Seconds(start) / repetitions;
+    std::cout <<"  parallel decode, " <<threads <<" threads " <<std::setprecision(1) <<megapixels / decodeTime <<" MP/s\n";
+
+    for(cppqoi::QoiLayout layout : {cppqoi::QoiLayout::Tiled, cppqoi::QoiLayout::Morton})
+    {
+        cppqoi::QoiDecodeOptions options;
+        options.layout = layout;
+        start = std::chrono::steady_clock::now();
+        for(unsigned i = 0; i < repetitions; i++)
+            cppqoi::LoadQoi(decoded, encoded, options);
+        decodeTime = Seconds(start) / repetitions;
+        std::cout <<"  " <<(layout == cppqoi::QoiLayout::Tiled ? "tiled" : "morton") <<" 8x8 decode " <<megapixels / decodeTime <<" MP/s\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned repetitions = argc > 1 ? std::stoul(argv[1]) : 5;
+    const char* tiers[] = {"baseline", "sse4.2", "avx2", "avx512"};
+    std::cout <<"kernel tier " <<tiers[static_cast<int>(cppqoi::GetKernelTier())] <<" (set CPPQOI_KERNEL_TIER to compare)\n";
+
+    if(argc > 2)
+    {
+        for(int i = 2; i < argc; i++)
+        {
+            cppqoi::QoiFile qoi;
+            if(!cppqoi::LoadQoi(argv[i], qoi))
+            {
+                std::cout <<"Failed to load " <<argv[i] <<"\n";
+                continue;
+            }
+            Run(argv[i], qoi, repetitions);
+        }
+        return 0;
+    }
+
+    Run("photo", Photo(1920, 1080), repetitions);
+    Run("interface", Interface(1920, 1080), repetitions);
+    return 0;
+}
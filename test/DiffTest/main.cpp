@@ -0,0 +1,859 @@
+#include <iostream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <cppqoi.hpp>
+#include "reference_qoi.h"
+
+/*
+    Differential test, checks every cppqoi encode/decode path against the
+    reference codec in reference_qoi.h.
+
+    Usage is DiffTest [iterations] [seed] [corpusDir]
+    Build with C++20 to include the coroutine row generator kernels.
+    Random images are generated and round-tripped through every kernel below,
+    every .qoi file found below corpusDir is decoded and re-encoded as well.
+    Alternate kernels are registered in EncodeKernels/DecodeKernels and run
+    side-by-side with the scalar ones. The random images cycle through every
+    QoiKernelTier the CPU supports.
+*/
+
+namespace constexpr_test
+{
+
+//a small RGBA icon, encoded and decoded entirely at compile time
+constexpr std::array<uint8_t, 8 * 4 * 4> icon = []
+{
+    std::array<uint8_t, 8 * 4 * 4> pixels{};
+    for(size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = static_cast<uint8_t>(i % 4 == 3 ? (i < 64 ? 255 : 128) : (i / 4) * 29 + (i % 4) * 3);
+    return pixels;
+}();
+
+constexpr auto encoded = cppqoi::EncodeQoi<8, 4, 4>(icon);
+
+constexpr std::array<uint8_t, encoded.size> blob = []
+{
+    std::array<uint8_t, encoded.size> data{};
+    for(size_t i = 0; i < data.size(); i++)
+        data[i] = encoded.data[i];
+    return data;
+}();
+
+constexpr cppqoi::QoiHeader header = cppqoi::ReadQoiHeader(blob);
+static_assert(header.IsValid() && header.width == 8 && header.height == 4 && header.channels == 4, "constexpr header");
+
+constexpr auto decoded = cppqoi::DecodeQoi<header.width, header.height, header.channels>(blob);
+static_assert([]
+{
+    for(size_t i = 0; i < icon.size(); i++)
+        if(decoded[i] != icon[i])
+            return false;
+    return true;
+}(), "constexpr round trip");
+
+}
+
+struct EncodeKernel
+{
+    std::string name;
+    std::function<bool(const cppqoi::QoiFile&, std::vector<uint8_t>&)> encode;
+};
+
+struct DecodeKernel
+{
+    std::string name;
+    std::function<bool(const std::vector<uint8_t>&, cppqoi::QoiFile&)> decode;
+};
+
+std::vector<EncodeKernel> EncodeKernels()
+{
+    return
+    {
+        {"WriteQoi(vector)", [](const cppqoi::QoiFile& qoi, std::vector<uint8_t>& out)
+        {
+            return cppqoi::WriteQoi(qoi, out);
+        }},
+        {"WriteQoi(ostream)", [](const cppqoi::QoiFile& qoi, std::vector<uint8_t>& out)
+        {
+            std::ostringstream stream;
+            bool success = cppqoi::WriteQoi(stream, qoi);
+            std::string str = stream.str();
+            out.assign(str.begin(), str.end());
+            return success;
+        }},
+        {"QoiOStream", [](const cppqoi::QoiFile& qoi, std::vector<uint8_t>& out)
+        {
+            std::shared_ptr<std::ostringstream> stream = std::make_shared<std::ostringstream>();
+            cppqoi::QoiOStream encoder(stream, qoi.width, qoi.height, qoi.channels, qoi.colorspace);
+            size_t rowSize = static_cast<size_t>(qoi.width) * qoi.channels;
+            for(uint32_t y = 0; y < qoi.height; y++)
+                if(!encoder.Write(qoi.pixelData.data() + y * rowSize, qoi.width, qoi.channels))
+                    return false;
+            bool success = encoder.Close();
+            std::string str = stream->str();
+            out.assign(str.begin(), str.end());
+            return success;
+        }},
+        {"QoiEncodeCache", [](const cppqoi::QoiFile& qoi, std::vector<uint8_t>& out)
+        {
+            //the second encode is answered from the cache and must match the first
+            cppqoi::QoiEncodeCache cache;
+            std::vector<uint8_t> first;
+            bool success = cppqoi::WriteQoi(qoi, first, cache) && cppqoi::WriteQoi(qoi, out, cache);
+            return success && out == first && cache.GetStats().hits == 1;
+        }},
+        {"QoiEncodeCache(disk)", [](const cppqoi::QoiFile& qoi, std::vector<uint8_t>& out)
+        {
+            //a fresh cache answers from the store, a truncated entry must be encoded again
+            std::filesystem::path dir = std::filesystem::temp_directory_path() / "cppqoi_difftest_cache";
+            std::filesystem::remove_all(dir);
+            std::vector<uint8_t> first, truncated;
+            cppqoi::QoiEncodeCache writer(0, dir.string()), reader(0, dir.string()), damaged(0, dir.string());
+            if(!cppqoi::WriteQoi(qoi, first, writer) || !cppqoi::WriteQoi(qoi, out, reader) || out != first || reader.GetStats().diskHits != 1)
+                return false;
+            for(const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(dir))
+                std::filesystem::resize_file(entry.path(), std::filesystem::file_size(entry.path()) - 1);
+            return cppqoi::WriteQoi(qoi, truncated, damaged) && truncated == first && damaged.GetStats().misses == 1;
+        }},
+        {"WriteQoiFromRaw", [](const cppqoi::QoiFile& qoi, std::vector<uint8_t>& out)
+        {
+            //windows of a few pixels, not a multiple of the pixel size, cross every row boundary
+            std::filesystem::path dir = std::filesystem::temp_directory_path();
+            std::string raw = (dir / "cppqoi_difftest.raw").string(), file = (dir / "cppqoi_difftest_raw.qoi").string();
+            std::ofstream(raw, std::ofstream::binary).write(reinterpret_cast<const char*>(qoi.pixelData.data()), qoi.pixelData.size());
+            cppqoi::QoiHeader header{qoi.width, qoi.height, qoi.channels, qoi.colorspace};
+            if(!cppqoi::WriteQoiFromRaw(raw, header, file, cppqoi::QoiEncodeOptions(), 1 + qoi.pixelData.size() % 29) ||
+               std::filesystem::exists(file + ".tmp"))
+                return false;
+            std::ifstream stream(file, std::ifstream::binary);
+            out.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+            return true;
+        }},
+    };
+}
+
+std::vector<DecodeKernel> DecodeKernels()
+{
+    return
+    {
+        {"LoadQoi(vector)", [](const std::vector<uint8_t>& data, cppqoi::QoiFile& qoi)
+        {
+            return cppqoi::LoadQoi(qoi, data);
+        }},
+        {"LoadQoi(istream)", [](const std::vector<uint8_t>& data, cppqoi::QoiFile& qoi)
+        {
+            std::istringstream stream(std::string(data.begin(), data.end()));
+            return cppqoi::LoadQoi(stream, qoi, data.size());
+        }},
+        {"QoiIStream", [](const std::vector<uint8_t>& data, cppqoi::QoiFile& qoi)
+        {
+            cppqoi::QoiIStream stream(std::make_shared<std::istringstream>(std::string(data.begin(), data.end())));
+            if(!stream.IsGood())
+                return false;
+            qoi.width = stream.GetWidth();
+            qoi.height = stream.GetHeight();
+            qoi.channels = stream.GetChannels();
+            qoi.colorspace = stream.GetColorspace();
+            qoi.pixelData.clear();
+            uint64_t pixelCount = static_cast<uint64_t>(qoi.width) * qoi.height;
+            while(stream.GetPixelIndex() < pixelCount)
+            {
+                cppqoi::Rgba rgba = stream.Get();
+                qoi.pixelData.push_back(rgba.r);
+                qoi.pixelData.push_back(rgba.g);
+                qoi.pixelData.push_back(rgba.b);
+                if(qoi.channels == 4)
+                    qoi.pixelData.push_back(rgba.a);
+            }
+            return true;
+        }},
+        {"LoadQoiParallel", [](const std::vector<uint8_t>& data, cppqoi::QoiFile& qoi)
+        {
+            //many small chunks and frequent checkpoints, so the boundary scan and the fix-up get exercised on small images
+            size_t chunks = 2 + data.size() % 7;
+            return cppqoi::Detail::LoadQoiParallel(qoi, data.data(), data.size(), cppqoi::QoiDecodeOptions(), chunks, 3, 1 + data.size() % 31);
+        }},
+        {"QoiPushDecoder", [](const std::vector<uint8_t>& data, cppqoi::QoiFile& qoi)
+        {
+            //uneven chunk sizes put chunk boundaries inside the header and inside every kind of op
+            cppqoi::QoiPushDecoder decoder([&](const uint8_t* row, uint32_t y)
+            {
+                if(y == 0)
+                    qoi = {{}, decoder.GetWidth(), decoder.GetHeight(), decoder.GetChannels(), decoder.GetColorspace()};
+                qoi.pixelData.insert(qoi.pixelData.end(), row, row + static_cast<size_t>(qoi.width) * qoi.channels);
+            });
+            size_t position = 0;
+            for(size_t chunk = 1; position < data.size(); chunk = chunk % 7 + 1)
+            {
+                size_t size = std::min(chunk, data.size() - position);
+                if(!decoder.Feed(data.data() + position, size))
+                    return false;
+                position += size;
+            }
+            return decoder.IsComplete();
+        }},
+        {"QoiArchive", [](const std::vector<uint8_t>& data, cppqoi::QoiFile& qoi)
+        {
+            //surround the image with other entries so the lookup has to search the index
+            cppqoi::QoiArchiveWriter writer;
+            cppqoi::QoiFile filler{std::vector<uint8_t>(4 * 3, 7), 2, 2, 3, 0};
+            std::string path = (std::filesystem::temp_directory_path() / "cppqoi_difftest.qoia").string();
+            if(!writer.Add("a", filler) || !writer.AddEncoded("image", data) || !writer.Add("z", filler) || !writer.Write(path))
+                return false;
+
+            cppqoi::QoiArchive archive(path);
+            size_t index;
+            cppqoi::QoiArchiveEntry entry;
+            bool success = archive.Find("image", index) && index == 1 && archive.GetEntry(index, entry) && archive.Load("image", qoi);
+            return success && entry.width == qoi.width && entry.height == qoi.height && entry.size == data.size();
+        }},
+        {"LoadQoiToRaw", [](const std::vector<uint8_t>& data, cppqoi::QoiFile& qoi)
+        {
+            std::filesystem::path dir = std::filesystem::temp_directory_path();
+            std::string file = (dir / "cppqoi_difftest_raw.qoi").string(), raw = (dir / "cppqoi_difftest.raw").string();
+            std::ofstream(file, std::ofstream::binary).write(reinterpret_cast<const char*>(data.data()), data.size());
+            cppqoi::QoiHeader header;
+            if(!cppqoi::LoadQoiToRaw(file, raw, header, cppqoi::QoiDecodeOptions(), 1 + data.size() % 23))
+                return false;
+            std::ifstream stream(raw, std::ifstream::binary);
+            qoi = {std::vector<uint8_t>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()), header.width, header.height, header.channels, header.colorspace};
+            return true;
+        }},
+#ifdef CPPQOI_COROUTINES
+        {"DecodeRows(vector)", [](const std::vector<uint8_t>& data, cppqoi::QoiFile& qoi)
+        {
+            cppqoi::QoiRowGenerator rows = cppqoi::DecodeRows(data);
+            qoi = {{}, rows.GetWidth(), rows.GetHeight(), rows.GetChannels(), rows.GetColorspace()};
+            for(std::span<const uint8_t> row : rows)
+                qoi.pixelData.insert(qoi.pixelData.end(), row.begin(), row.end());
+            return rows.IsValid() && rows.GetRowIndex() == qoi.height;
+        }},
+        {"DecodeRows(QoiIStream)", [](const std::vector<uint8_t>& data, cppqoi::QoiFile& qoi)
+        {
+            cppqoi::QoiIStream stream(std::make_shared<std::istringstream>(std::string(data.begin(), data.end())));
+            cppqoi::QoiRowGenerator rows = cppqoi::DecodeRows(stream);
+            qoi = {{}, rows.GetWidth(), rows.GetHeight(), rows.GetChannels(), rows.GetColorspace()};
+            while(rows.Next())
+                qoi.pixelData.insert(qoi.pixelData.end(), rows.GetRow().begin(), rows.GetRow().end());
+            return rows.IsValid();
+        }},
+#endif
+    };
+}
+
+/**
+  * @brief Generates test images that exercise every QOI op.
+  */
+class ImageGenerator
+{
+public:
+
+    ImageGenerator(uint32_t seed) : rng(seed) {}
+
+    cppqoi::QoiFile Next(void)
+    {
+        cppqoi::QoiFile qoi;
+        qoi.width = Dimension();
+        qoi.height = Dimension();
+        qoi.channels = Uniform(0, 1) ? 4 : 3;
+        qoi.colorspace = Uniform(0, 1);
+        qoi.pixelData.resize(static_cast<size_t>(qoi.width) * qoi.height * qoi.channels);
+
+        unsigned style = Uniform(0, 5);
+        std::vector<cppqoi::Rgba> palette(Uniform(1, 100));
+        for(cppqoi::Rgba& color : palette)
+            color = Random();
+
+        cppqoi::Rgba pixel = Random();
+        for(size_t i = 0; i < qoi.pixelData.size(); i += qoi.channels)
+        {
+            switch(style)
+            {
+            case 0: //noise, RGB(A) ops
+                pixel = Random();
+                break;
+            case 1: //small steps, DIFF ops
+                pixel = Step(pixel, 2, 0);
+                break;
+            case 2: //medium steps, LUMA ops
+                pixel = Step(pixel, 40, 8);
+                break;
+            case 3: //long runs
+                if(Uniform(0, 200) == 0)
+                    pixel = Random();
+                break;
+            case 4: //palette, INDEX ops
+                pixel = palette[Uniform(0, palette.size() - 1)];
+                break;
+            default: //a bit of everything
+                switch(Uniform(0, 4))
+                {
+                case 0: pixel = Random(); break;
+                case 1: pixel = Step(pixel, 2, 0); break;
+                case 2: pixel = Step(pixel, 40, 8); break;
+                case 3: pixel = palette[Uniform(0, palette.size() - 1)]; break;
+                default: break;
+                }
+            }
+
+            qoi.pixelData[i] = pixel.r;
+            qoi.pixelData[i + 1] = pixel.g;
+            qoi.pixelData[i + 2] = pixel.b;
+            if(qoi.channels == 4)
+                qoi.pixelData[i + 3] = pixel.a;
+        }
+        return qoi;
+    }
+
+private:
+
+    unsigned Uniform(unsigned low, unsigned high)
+    {
+        return std::uniform_int_distribution<unsigned>(low, high)(rng);
+    }
+
+    uint32_t Dimension(void)
+    {
+        switch(Uniform(0, 3))
+        {
+        case 0: return Uniform(1, 4);
+        case 1: return Uniform(1, 64);
+        default: return Uniform(1, 300);
+        }
+    }
+
+    cppqoi::Rgba Random(void)
+    {
+        //bias alpha towards opaque and a few fixed values so alpha changes stay rare
+        uint8_t a = Uniform(0, 3) ? 255 : static_cast<uint8_t>(Uniform(0, 2) * 127);
+        return cppqoi::Rgba(Uniform(0, 255), Uniform(0, 255), Uniform(0, 255), a);
+    }
+
+    cppqoi::Rgba Step(cppqoi::Rgba pixel, unsigned greenRange, unsigned redBlueRange)
+    {
+        int dg = static_cast<int>(Uniform(0, greenRange * 2)) - static_cast<int>(greenRange);
+        int dr = dg + static_cast<int>(Uniform(0, redBlueRange * 2)) - static_cast<int>(redBlueRange);
+        int db = dg + static_cast<int>(Uniform(0, redBlueRange * 2)) - static_cast<int>(redBlueRange);
+        if(redBlueRange == 0)
+        {
+            dr = static_cast<int>(Uniform(0, greenRange * 2)) - static_cast<int>(greenRange);
+            db = static_cast<int>(Uniform(0, greenRange * 2)) - static_cast<int>(greenRange);
+        }
+        pixel.r += dr;
+        pixel.g += dg;
+        pixel.b += db;
+        return pixel;
+    }
+
+    std::mt19937 rng;
+};
+
+class DiffTest
+{
+public:
+
+    /**
+      * @brief Round-trips raw pixels through every kernel and the reference codec.
+      * @return True if all outputs match.
+      */
+    bool CheckImage(const cppqoi::QoiFile& qoi, const std::string& name)
+    {
+        checks++;
+        std::vector<uint8_t> expected = reference::Encode(qoi.pixelData, qoi.width, qoi.height, qoi.channels, qoi.colorspace);
+
+        bool success = true;
+        for(const EncodeKernel& kernel : encoders)
+        {
+            std::vector<uint8_t> encoded;
+            if(!kernel.encode(qoi, encoded))
+                success = Fail(name, kernel.name, "encode failed");
+            else if(encoded != expected)
+                success = Fail(name, kernel.name, "encoded bytes differ from the reference encoder at byte " + std::to_string(FirstDifference(encoded, expected)));
+        }
+
+        success = CheckChannelOptions(qoi, name) && success;
+        success = CheckNearLossless(qoi, name) && success;
+        success = CheckPresets(qoi, name) && success;
+        success = CheckMips(qoi, name) && success;
+        success = CheckChecksum(qoi, expected, name) && success;
+        success = CheckLayouts(qoi, expected, name) && success;
+        return CheckDecode(expected, qoi.pixelData, name) && success;
+    }
+
+    /**
+      * @brief Decodes an existing QOI file with every kernel and the reference codec.
+      * @return True if all outputs match.
+      */
+    bool CheckFile(const std::vector<uint8_t>& data, const std::string& name)
+    {
+        checks++;
+        cppqoi::QoiFile qoi;
+        if(!reference::Decode(data, qoi.pixelData, qoi.width, qoi.height, qoi.channels, qoi.colorspace))
+            return Fail(name, "reference", "not a valid qoi file");
+        return CheckDecode(data, qoi.pixelData, name) && CheckImage(qoi, name + " (re-encoded)");
+    }
+
+    /**
+      * @brief Pushes more than QoiOStream's 64 KiB output buffer through Put and Write, in the worst
+      * case of a RUN op ended by an RGB(A) op so that it lands on every buffer offset. The Fastest
+      * preset also stores 5 scratch bytes after that RUN op. Overruns are only reported when built
+      * with AddressSanitizer.
+      */
+    bool CheckStreamBuffer(cppqoi::QoiPreset preset, uint8_t channels)
+    {
+        //alpha alternates so every new pixel is an RGBA op when there is an alpha channel
+        auto append = [channels](std::vector<uint8_t>& data, uint32_t i)
+        {
+            uint8_t pixel[4] = {static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8), 77, static_cast<uint8_t>(i % 2 ? 0 : 255)};
+            data.insert(data.end(), pixel, pixel + channels);
+        };
+
+        bool success = true;
+        //a prefix of 0 to 5 single pixels shifts the steps of a pixel and its repeat onto every offset
+        for(uint32_t prefix = 0; prefix < 6; prefix++)
+        {
+            cppqoi::QoiFile qoi{{}, 0, 1, channels, 0};
+            for(uint32_t i = 0; i < 12000; i++)
+                for(uint32_t k = 0; k < (i < prefix ? 1u : 2u); k++)
+                    append(qoi.pixelData, i);
+            qoi.width = static_cast<uint32_t>(qoi.pixelData.size() / channels);
+            success = CheckStream(qoi, qoi.width / 2, preset, "runs ending in new pixels, prefix " + std::to_string(prefix)) && success;
+        }
+
+        //the first Write leaves a run pending at offset 19 + runs, the second one ends it with a new pixel
+        for(uint32_t runs = 0; runs < 5; runs++)
+        {
+            cppqoi::QoiFile qoi{{}, 0, 1, channels, 0};
+            const uint8_t repeated[4] = {1, 2, 3, 0};
+            for(uint32_t i = 0; i < 62 * runs + 2; i++)
+                qoi.pixelData.insert(qoi.pixelData.end(), repeated, repeated + channels);
+            size_t split = qoi.pixelData.size() / channels;
+            for(uint32_t i = 0; i < 14000; i++)
+                append(qoi.pixelData, i);
+            qoi.width = static_cast<uint32_t>(qoi.pixelData.size() / channels);
+            success = CheckStream(qoi, split, preset, "pending run of " + std::to_string(62 * runs + 1)) && success;
+        }
+        return success;
+    }
+
+    size_t GetChecks(void) const
+    {
+        return checks;
+    }
+
+    size_t GetFailures(void) const
+    {
+        return failures;
+    }
+
+private:
+
+    /**
+      * @brief Checks opaque detection on encode and channel conversion on decode.
+      */
+    bool CheckChannelOptions(const cppqoi::QoiFile& qoi, const std::string& name)
+    {
+        //the same image with 3 and with 4 channels
+        std::vector<uint8_t> rgb, rgba;
+        for(size_t i = 0; i < qoi.pixelData.size(); i += qoi.channels)
+        {
+            rgb.insert(rgb.end(), qoi.pixelData.begin() + i, qoi.pixelData.begin() + i + 3);
+            rgba.insert(rgba.end(), qoi.pixelData.begin() + i, qoi.pixelData.begin() + i + 3);
+            rgba.push_back(qoi.channels == 4 ? qoi.pixelData[i + 3] : 255);
+        }
+        bool opaque = qoi.channels == 3 || cppqoi::Utility::IsOpaque(rgba.data(), rgba.size() / 4);
+        bool expectOpaque = true;
+        for(size_t i = 3; i < rgba.size(); i += 4)
+            expectOpaque = expectOpaque && rgba[i] == 255;
+        if(opaque != expectOpaque)
+            return Fail(name, "IsOpaque", "wrong result");
+
+        bool success = true;
+        cppqoi::QoiEncodeOptions encodeOptions;
+        encodeOptions.detectOpaque = true;
+        std::vector<uint8_t> encoded;
+        std::vector<uint8_t> expected = opaque ? reference::Encode(rgb, qoi.width, qoi.height, 3, qoi.colorspace) :
+                                                 reference::Encode(rgba, qoi.width, qoi.height, 4, qoi.colorspace);
+        if(!cppqoi::WriteQoi({rgba, qoi.width, qoi.height, 4, qoi.colorspace}, encoded, encodeOptions) || encoded != expected)
+            success = Fail(name, "WriteQoi(detectOpaque)", "encoded bytes differ from the reference encoder");
+
+        std::string raw = (std::filesystem::temp_directory_path() / "cppqoi_difftest_opaque.raw").string();
+        std::string file = (std::filesystem::temp_directory_path() / "cppqoi_difftest_opaque.qoi").string();
+        std::ofstream(raw, std::ofstream::binary).write(reinterpret_cast<const char*>(rgba.data()), rgba.size());
+        std::ifstream stream;
+        if(cppqoi::WriteQoiFromRaw(raw, {qoi.width, qoi.height, 4, qoi.colorspace}, file, encodeOptions, 1 + rgba.size() % 41))
+            stream.open(file, std::ifstream::binary);
+        if(std::vector<uint8_t>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()) != expected)
+            success = Fail(name, "WriteQoiFromRaw(detectOpaque)", "encoded bytes differ from the reference encoder");
+
+        for(uint8_t channels = 3; channels <= 4; channels++)
+        {
+            cppqoi::QoiDecodeOptions decodeOptions;
+            decodeOptions.channels = channels;
+            cppqoi::QoiFile decoded;
+            if(!cppqoi::LoadQoi(decoded, expected, decodeOptions) || decoded.channels != channels || decoded.pixelData != (channels == 3 ? rgb : rgba))
+                success = Fail(name, "LoadQoi(channels=" + std::to_string(channels) + ")", "decoded pixels differ");
+        }
+        return success;
+    }
+
+    /**
+      * @brief Encodes qoi through QoiOStream with Put and with two Write calls split at split pixels,
+      * both must match WriteQoi with the same preset.
+      */
+    bool CheckStream(const cppqoi::QoiFile& qoi, size_t split, cppqoi::QoiPreset preset, const std::string& name)
+    {
+        checks++;
+        std::string label = name + (qoi.channels == 3 ? ", RGB" : ", RGBA");
+        std::string kernel = preset == cppqoi::QoiPreset::Fastest ? "(Fastest)" : "(Balanced)";
+        cppqoi::QoiEncodeOptions options;
+        options.preset = preset;
+        std::vector<uint8_t> expected, pixels;
+        uint32_t width, height;
+        uint8_t channels, colorspace;
+        if(!cppqoi::WriteQoi(qoi, expected, options) || !reference::Decode(expected, pixels, width, height, channels, colorspace) || pixels != qoi.pixelData)
+            return Fail(label, "WriteQoi" + kernel, "reference decoder does not reproduce the image");
+
+        std::shared_ptr<std::ostringstream> stream = std::make_shared<std::ostringstream>();
+        cppqoi::QoiOStream encoder(stream, qoi.width, qoi.height, qoi.channels, qoi.colorspace);
+        bool success = encoder.SetPreset(preset);
+        for(size_t i = 0; i < qoi.pixelData.size(); i += qoi.channels)
+            success = encoder.Put({qoi.pixelData[i], qoi.pixelData[i + 1], qoi.pixelData[i + 2], qoi.channels == 4 ? qoi.pixelData[i + 3] : uint8_t(255)}) && success;
+        success = encoder.Close() && success;
+        std::string str = stream->str();
+        if(!success || std::vector<uint8_t>(str.begin(), str.end()) != expected)
+            return Fail(label, "QoiOStream::Put" + kernel, "encoded bytes differ from WriteQoi");
+
+        stream = std::make_shared<std::ostringstream>();
+        cppqoi::QoiOStream writer(stream, qoi.width, qoi.height, qoi.channels, qoi.colorspace);
+        success = writer.SetPreset(preset) && writer.Write(qoi.pixelData.data(), split, qoi.channels);
+        success = writer.Write(qoi.pixelData.data() + split * qoi.channels, qoi.width * qoi.height - split, qoi.channels) && success;
+        success = writer.Close() && success;
+        str = stream->str();
+        if(!success || std::vector<uint8_t>(str.begin(), str.end()) != expected)
+            return Fail(label, "QoiOStream::Write" + kernel, "encoded bytes differ from WriteQoi");
+        return true;
+    }
+
+    /**
+      * @brief Checks that the Fastest preset is lossless standard QOI, from WriteQoi and QoiOStream alike.
+      */
+    bool CheckPresets(const cppqoi::QoiFile& qoi, const std::string& name)
+    {
+        cppqoi::QoiEncodeOptions options;
+        options.preset = cppqoi::QoiPreset::Fastest;
+        std::vector<uint8_t> encoded, pixels;
+        uint32_t width, height;
+        uint8_t channels, colorspace;
+        if(!cppqoi::WriteQoi(qoi, encoded, options) || !reference::Decode(encoded, pixels, width, height, channels, colorspace))
+            return Fail(name, "WriteQoi(Fastest)", "encode failed");
+        if(pixels != qoi.pixelData || width != qoi.width || height != qoi.height || channels != qoi.channels)
+            return Fail(name, "WriteQoi(Fastest)", "reference decoder does not reproduce the image");
+
+        std::shared_ptr<std::ostringstream> stream = std::make_shared<std::ostringstream>();
+        cppqoi::QoiOStream encoder(stream, qoi.width, qoi.height, qoi.channels, qoi.colorspace);
+        bool success = encoder.SetPreset(cppqoi::QoiPreset::Fastest) && encoder.Write(qoi.pixelData.data(), pixels.size() / channels, channels);
+        success = encoder.Close() && success;
+        std::string str = stream->str();
+        if(!success || std::vector<uint8_t>(str.begin(), str.end()) != encoded)
+            return Fail(name, "QoiOStream(Fastest)", "encoded bytes differ from WriteQoi(Fastest)");
+        return true;
+    }
+
+    /**
+      * @brief Bitwise CRC32C, independent of the table and SSE4.2 paths in cppqoi.
+      */
+    static uint32_t Crc32c(const std::vector<uint8_t>& data)
+    {
+        uint32_t crc = 0xffffffff;
+        for(uint8_t byte : data)
+        {
+            crc ^= byte;
+            for(int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+        }
+        return ~crc;
+    }
+
+    /**
+      * @brief Checks the checksum chunk from every encoder, its verification and that plain decoders still read the file.
+      */
+    bool CheckChecksum(const cppqoi::QoiFile& qoi, const std::vector<uint8_t>& plain, const std::string& name)
+    {
+        std::vector<uint8_t> expected = plain;
+        uint32_t crc = Crc32c(plain);
+        expected.insert(expected.end(), {'q', 'c', 'r', 'c', static_cast<uint8_t>(crc >> 24), static_cast<uint8_t>(crc >> 16),
+                                         static_cast<uint8_t>(crc >> 8), static_cast<uint8_t>(crc)});
+
+        cppqoi::QoiEncodeOptions options;
+        options.checksum = true;
+        std::vector<uint8_t> encoded;
+        if(!cppqoi::WriteQoi(qoi, encoded, options) || encoded != expected)
+            return Fail(name, "WriteQoi(checksum)", "encoded bytes differ from the reference encoder plus checksum");
+
+        std::shared_ptr<std::ostringstream> stream = std::make_shared<std::ostringstream>();
+        cppqoi::QoiOStream encoder(stream, qoi.width, qoi.height, qoi.channels, qoi.colorspace);
+        bool success = encoder.SetChecksum(true) && encoder.Write(qoi.pixelData.data(), qoi.pixelData.size() / qoi.channels, qoi.channels);
+        success = encoder.Close() && success;
+        std::string str = stream->str();
+        if(!success || std::vector<uint8_t>(str.begin(), str.end()) != expected)
+            return Fail(name, "QoiOStream(checksum)", "encoded bytes differ from the reference encoder plus checksum");
+
+        std::vector<std::vector<uint8_t>> levels;
+        if(!cppqoi::WriteQoiMips(qoi, levels, options, 1) || levels[0] != expected)
+            return Fail(name, "WriteQoiMips(checksum)", "encoded bytes differ from the reference encoder plus checksum");
+
+        cppqoi::QoiDecodeOptions verify;
+        verify.verifyChecksum = true;
+        cppqoi::QoiFile decoded;
+        if(!cppqoi::LoadQoi(decoded, expected, verify) || decoded.pixelData != qoi.pixelData)
+            return Fail(name, "LoadQoi(verifyChecksum)", "valid checksum rejected");
+        if(cppqoi::LoadQoi(decoded, plain, verify))
+            return Fail(name, "LoadQoi(verifyChecksum)", "missing checksum accepted");
+
+        std::vector<uint8_t> corrupt = expected;
+        corrupt[cppqoi::CPPQOI_HEADER_SIZE + checks % (corrupt.size() - cppqoi::CPPQOI_HEADER_SIZE - 8)] ^= 0x10;
+        if(cppqoi::LoadQoi(decoded, corrupt, verify))
+            return Fail(name, "LoadQoi(verifyChecksum)", "corrupted file accepted");
+        verify.layout = cppqoi::QoiLayout::Morton;
+        if(!cppqoi::LoadQoi(decoded, expected, verify) || cppqoi::LoadQoi(decoded, corrupt, verify))
+            return Fail(name, "LoadQoi(Morton, verifyChecksum)", "checksum verified wrongly");
+        verify.layout = cppqoi::QoiLayout::Linear;
+
+        //the out-of-core decoder checksums its input one window at a time
+        std::string file = (std::filesystem::temp_directory_path() / "cppqoi_difftest_crc.qoi").string();
+        std::string raw = (std::filesystem::temp_directory_path() / "cppqoi_difftest_crc.raw").string();
+        auto loadToRaw = [&](const std::vector<uint8_t>& data)
+        {
+            std::ofstream(file, std::ofstream::binary).write(reinterpret_cast<const char*>(data.data()), data.size());
+            cppqoi::QoiHeader header;
+            return cppqoi::LoadQoiToRaw(file, raw, header, verify, 1 + checks % 37);
+        };
+        std::vector<uint8_t> badTag = expected;
+        badTag[badTag.size() - 5] = 'X';
+        if(!loadToRaw(expected) || loadToRaw(corrupt))
+            return Fail(name, "LoadQoiToRaw(verifyChecksum)", "checksum verified wrongly");
+        if(loadToRaw(plain))
+            return Fail(name, "LoadQoiToRaw(verifyChecksum)", "missing checksum accepted");
+        if(loadToRaw(badTag) || cppqoi::LoadQoi(decoded, badTag, verify))
+            return Fail(name, "LoadQoiToRaw(verifyChecksum)", "checksum chunk with a bad tag accepted");
+
+        //decoders that do not know the chunk read the file as before
+        std::vector<uint8_t> pixels;
+        uint32_t width, height;
+        uint8_t channels, colorspace;
+        if(!reference::Decode(expected, pixels, width, height, channels, colorspace) || pixels != qoi.pixelData ||
+           !cppqoi::LoadQoi(decoded, expected) || decoded.pixelData != qoi.pixelData)
+            return Fail(name, "checksum", "file with checksum decodes differently");
+        return true;
+    }
+
+    /**
+      * @brief Checks decoding into the tiled and Morton layouts against the row-major image, moved pixel by pixel.
+      */
+    bool CheckLayouts(const cppqoi::QoiFile& qoi, const std::vector<uint8_t>& encoded, const std::string& name)
+    {
+        cppqoi::QoiDecodeOptions options;
+        options.tileSize = 1u << (checks % 6);
+        uint32_t tile = options.tileSize;
+        size_t tilesX = (qoi.width + tile - 1) / tile, tilesY = (qoi.height + tile - 1) / tile;
+
+        for(cppqoi::QoiLayout layout : {cppqoi::QoiLayout::Tiled, cppqoi::QoiLayout::Morton})
+        {
+            bool morton = layout == cppqoi::QoiLayout::Morton;
+            std::string kernel = std::string("LoadQoi(") + (morton ? "Morton " : "Tiled ") + std::to_string(tile) + ")";
+            std::vector<uint8_t> expected(tilesX * tilesY * tile * tile * qoi.channels, 0);
+            for(uint32_t y = 0; y < qoi.height; y++)
+                for(uint32_t x = 0; x < qoi.width; x++)
+                {
+                    size_t inTile = 0;
+                    uint32_t tx = x % tile, ty = y % tile;
+                    if(morton)
+                        for(uint32_t bit = 0; (1u << bit) < tile; bit++)
+                            inTile |= ((tx >> bit) & 1) << (2 * bit) | ((ty >> bit) & 1) << (2 * bit + 1);
+                    else
+                        inTile = ty * tile + tx;
+                    size_t index = ((y / tile) * tilesX + x / tile) * tile * tile + inTile;
+                    std::copy_n(qoi.pixelData.begin() + (static_cast<size_t>(y) * qoi.width + x) * qoi.channels, qoi.channels,
+                                expected.begin() + index * qoi.channels);
+                }
+
+            options.layout = layout;
+            cppqoi::QoiFile decoded;
+            if(!cppqoi::LoadQoi(decoded, encoded, options) || decoded.pixelData != expected ||
+               decoded.width != qoi.width || decoded.height != qoi.height)
+                return Fail(name, kernel, "pixels are not where the layout puts them");
+        }
+        return true;
+    }
+
+    /**
+      * @brief Checks every level of WriteQoiMips against a plainly downsampled image run through the reference encoder.
+      */
+    bool CheckMips(const cppqoi::QoiFile& qoi, const std::string& name)
+    {
+        unsigned threads = 1 + checks % 2;
+        std::string kernel = "WriteQoiMips(threads=" + std::to_string(threads) + ")";
+        std::vector<std::vector<uint8_t>> levels;
+        if(!cppqoi::WriteQoiMips(qoi, levels, cppqoi::QoiEncodeOptions(), 0, threads))
+            return Fail(name, kernel, "encode failed");
+
+        cppqoi::QoiFile level = qoi;
+        for(size_t i = 0; i < levels.size(); i++)
+        {
+            if(levels[i] != reference::Encode(level.pixelData, level.width, level.height, level.channels, level.colorspace))
+                return Fail(name, kernel, "level " + std::to_string(i) + " differs from the reference encoder");
+            if(level.width == 1 && level.height == 1)
+                return i + 1 == levels.size() || Fail(name, kernel, "levels beyond 1x1");
+
+            cppqoi::QoiFile next{{}, std::max(1u, level.width / 2), std::max(1u, level.height / 2), level.channels, level.colorspace};
+            for(uint32_t y = 0; y < next.height; y++)
+                for(uint32_t x = 0; x < next.width; x++)
+                    for(uint8_t c = 0; c < level.channels; c++)
+                    {
+                        auto at = [&](uint32_t px, uint32_t py)
+                        {
+                            px = std::min(px, level.width - 1);
+                            py = std::min(py, level.height - 1);
+                            return level.pixelData[(static_cast<size_t>(py) * level.width + px) * level.channels + c];
+                        };
+                        next.pixelData.push_back(static_cast<uint8_t>((at(2 * x, 2 * y) + at(2 * x + 1, 2 * y) + at(2 * x, 2 * y + 1) + at(2 * x + 1, 2 * y + 1) + 2) / 4));
+                    }
+            level = next;
+        }
+        return Fail(name, kernel, "chain stops before 1x1");
+    }
+
+    /**
+      * @brief Checks that near-lossless output is standard QOI and stays within its error bound.
+      */
+    bool CheckNearLossless(const cppqoi::QoiFile& qoi, const std::string& name)
+    {
+        cppqoi::QoiEncodeOptions options;
+        uint8_t bound = static_cast<uint8_t>(1 + checks % 8);
+        options.maxError = {bound, static_cast<uint8_t>(bound / 2), bound, static_cast<uint8_t>(checks % 3)};
+        std::string kernel = "WriteQoi(maxError=" + std::to_string(bound) + ")";
+
+        std::vector<uint8_t> encoded, pixels;
+        cppqoi::QoiFile decoded;
+        uint32_t width, height;
+        uint8_t channels, colorspace;
+        if(!cppqoi::WriteQoi(qoi, encoded, options) || !reference::Decode(encoded, pixels, width, height, channels, colorspace))
+            return Fail(name, kernel, "encode failed");
+        if(!cppqoi::LoadQoi(decoded, encoded) || decoded.pixelData != pixels)
+            return Fail(name, kernel, "decoders disagree on near-lossless output");
+
+        for(size_t i = 0; i < pixels.size(); i++)
+            if(std::abs(static_cast<int>(pixels[i]) - qoi.pixelData[i]) > options.maxError[i % qoi.channels])
+                return Fail(name, kernel, "error bound exceeded at byte " + std::to_string(i));
+        return true;
+    }
+
+    bool CheckDecode(const std::vector<uint8_t>& data, const std::vector<uint8_t>& expected, const std::string& name)
+    {
+        bool success = true;
+        for(const DecodeKernel& kernel : decoders)
+        {
+            cppqoi::QoiFile decoded;
+            if(!kernel.decode(data, decoded))
+                success = Fail(name, kernel.name, "decode failed");
+            else if(decoded.pixelData != expected)
+                success = Fail(name, kernel.name, "decoded pixels differ from the reference decoder at byte " + std::to_string(FirstDifference(decoded.pixelData, expected)));
+        }
+        return success;
+    }
+
+    static size_t FirstDifference(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b)
+    {
+        size_t i = 0;
+        while(i < a.size() && i < b.size() && a[i] == b[i])
+            i++;
+        return i;
+    }
+
+    bool Fail(const std::string& image, const std::string& kernel, const std::string& what)
+    {
+        failures++;
+        std::cout <<"FAIL " <<image <<" [" <<kernel <<"]: " <<what <<"\n";
+        return false;
+    }
+
+    std::vector<EncodeKernel> encoders = EncodeKernels();
+    std::vector<DecodeKernel> decoders = DecodeKernels();
+    size_t checks = 0;
+    size_t failures = 0;
+};
+
+int main(int argc, char* argv[])
+{
+    unsigned iterations = argc > 1 ? std::stoul(argv[1]) : 500;
+    uint32_t seed = argc > 2 ? std::stoul(argv[2]) : 1;
+    std::string corpus = argc > 3 ? argv[3] : "";
+
+    DiffTest test;
+
+    //fixed edge cases: single pixels, runs at the 62 pixel limit and the initial pixel
+    const std::vector<uint32_t> runLengths {1, 61, 62, 63, 124, 125};
+    for(uint32_t length : runLengths)
+        for(uint8_t channels = 3; channels <= 4; channels++)
+        {
+            cppqoi::QoiFile qoi{std::vector<uint8_t>(length * channels, 0), length, 1, channels, 0};
+            for(size_t i = 3; channels == 4 && i < qoi.pixelData.size(); i += 4)
+                qoi.pixelData[i] = 255;
+            test.CheckImage(qoi, "run " + std::to_string(length) + "x" + std::to_string(channels));
+        }
+
+    //sizes beyond 32 bits must be rejected, not wrapped around
+    std::vector<uint8_t> wrapped;
+    if(cppqoi::WriteQoi({{}, 65536, 65536, 4, 0}, wrapped) || cppqoi::QoiMaxSize(65536, 65536, 4) != 5ull * 65536 * 65536 + 22)
+    {
+        std::cout <<"FAIL 65536x65536x4 [WriteQoi]: size computed in 32 bits\n";
+        return 1;
+    }
+
+    for(cppqoi::QoiPreset preset : {cppqoi::QoiPreset::Balanced, cppqoi::QoiPreset::Fastest})
+        for(uint8_t channels : {3, 4})
+            test.CheckStreamBuffer(preset, channels);
+
+    //the compile time codec must agree with the reference at run time too
+    std::vector<uint8_t> icon(constexpr_test::icon.begin(), constexpr_test::icon.end());
+    if(reference::Encode(icon, 8, 4, 4, 0) != std::vector<uint8_t>(constexpr_test::blob.begin(), constexpr_test::blob.end()))
+    {
+        std::cout <<"FAIL constexpr icon [EncodeQoi]: encoded bytes differ from the reference encoder\n";
+        return 1;
+    }
+
+    //every kernel tier this CPU supports takes its turn
+    std::vector<cppqoi::QoiKernelTier> tiers;
+    for(uint8_t tier = 0; tier <= static_cast<uint8_t>(cppqoi::GetMaxKernelTier()); tier++)
+        tiers.push_back(static_cast<cppqoi::QoiKernelTier>(tier));
+    cppqoi::QoiKernelTier initialTier = cppqoi::GetKernelTier();
+
+    ImageGenerator generator(seed);
+    for(unsigned i = 0; i < iterations; i++)
+    {
+        cppqoi::QoiFile qoi = generator.Next();
+        cppqoi::SetKernelTier(tiers[i % tiers.size()]);
+        test.CheckImage(qoi, "random #" + std::to_string(i) + " seed " + std::to_string(seed) + " " +
+                        std::to_string(qoi.width) + "x" + std::to_string(qoi.height) + "x" + std::to_string(qoi.channels) +
+                        " tier " + std::to_string(i % tiers.size()));
+    }
+    cppqoi::SetKernelTier(initialTier);
+
+    if(!corpus.empty())
+    {
+        std::error_code ec;
+        for(auto it = std::filesystem::recursive_directory_iterator(corpus, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+        {
+            if(!it->is_regular_file() || it->path().extension() != ".qoi")
+                continue;
+            std::ifstream file(it->path(), std::ifstream::binary);
+            std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            test.CheckFile(data, it->path().string());
+        }
+    }
+
+    std::cout <<test.GetChecks() <<" images checked, " <<test.GetFailures() <<" failures\n";
+    return test.GetFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+#ifndef REFERENCE_QOI_H_INCLUDED
+#define REFERENCE_QOI_H_INCLUDED
+
+/*
+    Reference QOI codec used by the differential test.
+
+    A direct transcription of the encoder and decoder described in the QOI
+    specification (https://qoiformat.org/qoi-specification.pdf), laid out the
+    same way as the qoi.h reference implementation. It deliberately shares no
+    code with cppqoi.hpp so that both can be checked against each other.
+*/
+
+#include <cstdint>
+#include <vector>
+
+namespace reference
+{
+
+struct Pixel
+{
+    uint8_t r, g, b, a;
+};
+
+inline bool operator==(const Pixel& x, const Pixel& y)
+{
+    return x.r == y.r && x.g == y.g && x.b == y.b && x.a == y.a;
+}
+
+inline unsigned Hash(const Pixel& p)
+{
+    return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+}
+
+inline void Put32(std::vector<uint8_t>& out, uint32_t v)
+{
+    out.push_back((0xff000000 & v) >> 24);
+    out.push_back((0x00ff0000 & v) >> 16);
+    out.push_back((0x0000ff00 & v) >> 8);
+    out.push_back((0x000000ff & v));
+}
+
+inline uint32_t Get32(const std::vector<uint8_t>& in, size_t& p)
+{
+    uint32_t a = in[p++], b = in[p++], c = in[p++], d = in[p++];
+    return a << 24 | b << 16 | c << 8 | d;
+}
+
+/**
+  * @brief Encodes raw pixels, returns an empty vector on invalid input.
+  */
+inline std::vector<uint8_t> Encode(const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height, uint8_t channels, uint8_t colorspace)
+{
+    std::vector<uint8_t> out;
+    if(width == 0 || height == 0 || channels < 3 || channels > 4 || colorspace > 1 ||
+       pixels.size() != static_cast<size_t>(width) * height * channels)
+        return out;
+
+    out.push_back('q');
+    out.push_back('o');
+    out.push_back('i');
+    out.push_back('f');
+    Put32(out, width);
+    Put32(out, height);
+    out.push_back(channels);
+    out.push_back(colorspace);
+
+    Pixel index[64] = {};
+    Pixel prev = {0, 0, 0, 255};
+    Pixel px = prev;
+    int run = 0;
+
+    size_t pxLen = pixels.size();
+    size_t pxEnd = pxLen - channels;
+
+    for(size_t pos = 0; pos < pxLen; pos += channels)
+    {
+        px.r = pixels[pos + 0];
+        px.g = pixels[pos + 1];
+        px.b = pixels[pos + 2];
+        if(channels == 4)
+            px.a = pixels[pos + 3];
+
+        if(px == prev)
+        {
+            run++;
+            if(run == 62 || pos == pxEnd)
+            {
+                out.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+        }
+        else
+        {
+            if(run > 0)
+            {
+                out.push_back(0xc0 | (run - 1));
+                run = 0;
+            }
+
+            unsigned indexPos = Hash(px);
+            if(index[indexPos] == px)
+                out.push_back(0x00 | indexPos);
+            else
+            {
+                index[indexPos] = px;
+
+                if(px.a == prev.a)
+                {
+                    signed char vr = px.r - prev.r;
+                    signed char vg = px.g - prev.g;
+                    signed char vb = px.b - prev.b;
+                    signed char vgr = vr - vg;
+                    signed char vgb = vb - vg;
+
+                    if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                        out.push_back(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                    else if(vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+                    {
+                        out.push_back(0x80 | (vg + 32));
+                        out.push_back((vgr + 8) << 4 | (vgb + 8));
+                    }
+                    else
+                    {
+                        out.push_back(0xfe);
+                        out.push_back(px.r);
+                        out.push_back(px.g);
+                        out.push_back(px.b);
+                    }
+                }
+                else
+                {
+                    out.push_back(0xff);
+                    out.push_back(px.r);
+                    out.push_back(px.g);
+                    out.push_back(px.b);
+                    out.push_back(px.a);
+                }
+            }
+        }
+        prev = px;
+    }
+
+    for(int i = 0; i < 7; i++)
+        out.push_back(0);
+    out.push_back(1);
+    return out;
+}
+
+/**
+  * @brief Decodes a QOI file, returns false on an invalid header.
+  */
+inline bool Decode(const std::vector<uint8_t>& data, std::vector<uint8_t>& pixels, uint32_t& width, uint32_t& height, uint8_t& channels, uint8_t& colorspace)
+{
+    const size_t headerSize = 14, paddingSize = 8;
+    if(data.size() < headerSize + paddingSize)
+        return false;
+
+    size_t p = 0;
+    if(data[p++] != 'q' || data[p++] != 'o' || data[p++] != 'i' || data[p++] != 'f')
+        return false;
+    width = Get32(data, p);
+    height = Get32(data, p);
+    channels = data[p++];
+    colorspace = data[p++];
+    if(width == 0 || height == 0 || channels < 3 || channels > 4 || colorspace > 1)
+        return false;
+
+    size_t pxLen = static_cast<size_t>(width) * height * channels;
+    pixels.assign(pxLen, 0);
+
+    Pixel index[64] = {};
+    Pixel px = {0, 0, 0, 255};
+    int run = 0;
+    size_t chunksLen = data.size() - paddingSize;
+
+    for(size_t pos = 0; pos < pxLen; pos += channels)
+    {
+        if(run > 0)
+            run--;
+        else if(p < chunksLen)
+        {
+            int b1 = data[p++];
+
+            if(b1 == 0xfe)
+            {
+                px.r = data[p++];
+                px.g = data[p++];
+                px.b = data[p++];
+            }
+            else if(b1 == 0xff)
+            {
+                px.r = data[p++];
+                px.g = data[p++];
+                px.b = data[p++];
+                px.a = data[p++];
+            }
+            else if((b1 & 0xc0) == 0x00)
+                px = index[b1];
+            else if((b1 & 0xc0) == 0x40)
+            {
+                px.r += ((b1 >> 4) & 0x03) - 2;
+                px.g += ((b1 >> 2) & 0x03) - 2;
+                px.b += ( b1       & 0x03) - 2;
+            }
+            else if((b1 & 0xc0) == 0x80)
+            {
+                int b2 = data[p++];
+                int vg = (b1 & 0x3f) - 32;
+                px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                px.g += vg;
+                px.b += vg - 8 +  (b2       & 0x0f);
+            }
+            else if((b1 & 0xc0) == 0xc0)
+                run = (b1 & 0x3f);
+
+            index[Hash(px)] = px;
+        }
+
+        pixels[pos + 0] = px.r;
+        pixels[pos + 1] = px.g;
+        pixels[pos + 2] = px.b;
+        if(channels == 4)
+            pixels[pos + 3] = px.a;
+    }
+    return true;
+}
+
+}
+
+#endif // REFERENCE_QOI_H_INCLUDED
@@ -27,7 +27,7 @@ int main(int argc, char* argv[])
     uint32_t height = stream.GetHeight();
     std::cout << width << " "<< height<<"\n";
 
-    while(stream.GetPixelIndex() < width * height)
+    while(stream.GetPixelIndex() < static_cast<uint64_t>(width) * height)
     {
         cppqoi::Rgba rgba = stream.Get();
         std::cout << ((uint32_t)rgba.r) <<" " <<((uint32_t)rgba.g) <<" " <<
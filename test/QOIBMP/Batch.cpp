@@ -0,0 +1,223 @@
+#include "Batch.h"
+#include "Bitmap.h"
+#include <cppqoi.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+struct Job
+{
+    std::filesystem::path input;
+    std::filesystem::path output;
+    bool encode;
+};
+
+bool EncodeFile(const Job& job, BatchStats& stats)
+{
+    uint64_t pixels = 0;
+    if(!EncodeToQoi(job.input.string(), job.output.string(), &pixels))
+        return false;
+
+    stats.pixels += pixels;
+    return true;
+}
+
+bool DecodeFile(const Job& job, BatchStats& stats)
+{
+    cppqoi::QoiFile qoi;
+    if(!cppqoi::LoadQoi(job.input.string(), qoi))
+        return false;
+
+    Bitmap bitmap;
+    bitmap.SetRaw(qoi.pixelData, qoi.width, qoi.height, qoi.channels);
+    if(!bitmap.SaveToFile(job.output.string()))
+    {
+        //a partly written output would be taken as up to date by the next run
+        std::error_code ec;
+        std::filesystem::remove(job.output, ec);
+        return false;
+    }
+
+    stats.pixels += static_cast<uint64_t>(qoi.width) * qoi.height;
+    return true;
+}
+
+bool IsUpToDate(const Job& job)
+{
+    std::error_code ec;
+    if(!std::filesystem::exists(job.output, ec))
+        return false;
+    auto outTime = std::filesystem::last_write_time(job.output, ec);
+    if(ec)
+        return false;
+    auto inTime = std::filesystem::last_write_time(job.input, ec);
+    return !ec && outTime >= inTime;
+}
+
+std::vector<Job> CollectJobs(const std::filesystem::path& sourceDir, const std::filesystem::path& destDir)
+{
+    std::vector<Job> jobs;
+    std::error_code ec;
+    for(auto it = std::filesystem::recursive_directory_iterator(sourceDir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+    {
+        if(!it->is_regular_file())
+            continue;
+
+        std::filesystem::path extension = it->path().extension();
+        std::filesystem::path output = destDir / std::filesystem::relative(it->path(), sourceDir);
+        if(extension == ".bmp" || extension == ".png")
+            jobs.push_back({it->path(), output.replace_extension(".qoi"), true});
+        else
+        if(extension == ".qoi")
+            jobs.push_back({it->path(), output.replace_extension(".png"), false});
+    }
+    return jobs;
+}
+
+/**
+  * @brief Removes every job whose output another job writes as well, like foo.bmp and foo.png both
+  * encoding to foo.qoi. None of them is converted, the result would depend on the order of the workers.
+  * @return Number of removed jobs.
+  */
+size_t RemoveDuplicateOutputs(std::vector<Job>& jobs)
+{
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.output < b.output; });
+    std::vector<Job> unique;
+    size_t removed = 0;
+    for(size_t i = 0, end; i < jobs.size(); i = end)
+    {
+        end = i + 1;
+        while(end < jobs.size() && jobs[end].output == jobs[i].output)
+            end++;
+        if(end - i == 1)
+        {
+            unique.push_back(jobs[i]);
+            continue;
+        }
+        for(size_t k = i; k < end; k++)
+            std::cout <<"Failed to convert " <<jobs[k].input.string() <<": " <<end - i <<" files convert to " <<jobs[k].output.string() <<"\n";
+        removed += end - i;
+    }
+    jobs.swap(unique);
+    return removed;
+}
+
+}
+
+bool EncodeToQoi(const std::string& inputFile, const std::string& outputFile, uint64_t* pixels)
+{
+    //encode to a temporary file so a failed source never leaves an output that looks complete and up to date
+    std::string tempFile = outputFile + ".tmp";
+    cppqoi::QoiOStream qoi;
+    uint32_t width = 0;
+
+    auto onHeader = [&](uint32_t w, uint32_t h, bool hasAlpha)
+    {
+        //sources without alpha are written as 3 channel files, dropping all alpha work from the encoder
+        width = w;
+        return qoi.Open(tempFile, w, h, hasAlpha ? 4 : 3, 1);
+    };
+    auto onRow = [&](const uint8_t* rgba)
+    {
+        return qoi.Write(rgba, width, 4);
+    };
+
+    bool success = Bitmap::StreamFromFile(inputFile, onHeader, onRow);
+    if(pixels)
+        *pixels = qoi.GetPixelIndex();
+    success = qoi.Close() && success;
+
+    std::error_code ec;
+    if(success)
+        std::filesystem::rename(tempFile, outputFile, ec);
+    if(!success || ec)
+    {
+        std::filesystem::remove(tempFile, ec);
+        return false;
+    }
+    return true;
+}
+
+bool ConvertDirectory(const std::string& sourceDir, const std::string& destDir, unsigned threads, BatchStats& stats)
+{
+    auto start = std::chrono::steady_clock::now();
+    stats = BatchStats();
+
+    std::vector<Job> jobs = CollectJobs(sourceDir, destDir);
+    stats.failed = RemoveDuplicateOutputs(jobs);
+
+    if(threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::atomic<size_t> next{0};
+    std::mutex statsMutex;
+
+    auto worker = [&]()
+    {
+        BatchStats local;
+        for(size_t i = next++; i < jobs.size(); i = next++)
+        {
+            const Job& job = jobs[i];
+            if(IsUpToDate(job))
+            {
+                local.skipped++;
+                continue;
+            }
+
+            std::error_code ec;
+            std::filesystem::create_directories(job.output.parent_path(), ec);
+
+            bool success = job.encode ? EncodeFile(job, local) : DecodeFile(job, local);
+            if(!success)
+            {
+                local.failed++;
+                std::lock_guard<std::mutex> lock(statsMutex);
+                std::cout <<"Failed to convert " <<job.input.string() <<"\n";
+                continue;
+            }
+
+            local.files++;
+            uintmax_t inputSize = std::filesystem::file_size(job.input, ec);
+            local.inputBytes += ec ? 0 : inputSize;
+            uintmax_t outputSize = std::filesystem::file_size(job.output, ec);
+            local.outputBytes += ec ? 0 : outputSize;
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.files += local.files;
+        stats.skipped += local.skipped;
+        stats.failed += local.failed;
+        stats.pixels += local.pixels;
+        stats.inputBytes += local.inputBytes;
+        stats.outputBytes += local.outputBytes;
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned i = 1; i < threads; i++)
+        pool.emplace_back(worker);
+    worker();
+    for(std::thread& t : pool)
+        t.join();
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats.failed == 0;
+}
+
+void PrintBatchStats(const BatchStats& stats)
+{
+    double seconds = stats.seconds > 0.0 ? stats.seconds : 1e-9;
+    std::cout <<"Converted " <<stats.files <<" files, skipped " <<stats.skipped <<", failed " <<stats.failed
+              <<" in " <<stats.seconds <<"s\n";
+    std::cout <<"Throughput: " <<(stats.files / seconds) <<" files/s, "
+              <<(stats.pixels / seconds / 1e6) <<" MP/s\n";
+    if(stats.inputBytes)
+        std::cout <<"Size ratio (out/in): " <<(static_cast<double>(stats.outputBytes) / stats.inputBytes) <<"\n";
+}
@@ -0,0 +1,48 @@
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+/**
+  * @brief Aggregate results of a batch conversion.
+  */
+struct BatchStats
+{
+    size_t files = 0;       /// files converted
+    size_t skipped = 0;     /// files skipped because the output was up to date
+    size_t failed = 0;      /// files that failed to convert
+    uint64_t pixels = 0;    /// pixels processed over all converted files
+    uint64_t inputBytes = 0;    /// bytes read from source files
+    uint64_t outputBytes = 0;   /// bytes written to destination files
+    double seconds = 0.0;   /// wall time of the whole batch
+};
+
+/**
+  * @brief Transcodes a .bmp or .png file to QOI row by row.
+  * Only a single row of the image is held in memory at any time.
+  * Sources without an alpha channel are written as 3 channel files.
+  * @param pixels If not null, receives the number of encoded pixels.
+  * @return True on success.
+  */
+bool EncodeToQoi(const std::string& inputFile, const std::string& outputFile, uint64_t* pixels = nullptr);
+
+/**
+  * @brief Converts every supported file below sourceDir into destDir.
+  * .bmp and .png files are encoded to .qoi, .qoi files are decoded to .png.
+  * The relative directory layout is kept, outputs newer than their source are skipped.
+  * Sources that convert to the same output, like foo.bmp and foo.png, fail and are not converted.
+  * @param sourceDir Directory walked recursively for input files.
+  * @param destDir Directory receiving the converted files.
+  * @param threads Number of worker threads, 0 uses the hardware concurrency.
+  * @param stats Receives the aggregate statistics.
+  * @return True if no file failed to convert.
+  */
+bool ConvertDirectory(const std::string& sourceDir, const std::string& destDir, unsigned threads, BatchStats& stats);
+
+/**
+  * @brief Prints files/s, MP/s and the size ratio of a batch.
+  */
+void PrintBatchStats(const BatchStats& stats);
+
+#endif // BATCH_H_INCLUDED
@@ -2,6 +2,7 @@
 #include <fstream>
 #include <iostream>
 #include <filesystem>
+#include <memory>
 #include <png.h>
 
 Bitmap::Bitmap() : sizeX(0), sizeY(0), colorData()
@@ -52,7 +53,7 @@ bool Bitmap::SaveBMP(const std::string& filename)
     out.put('M');
     Header head;
     InfoHeader info;
-    head.fileSize = sizeof(head) + sizeof(info) + sizeof(Color) * colorData.size() + 2 + padding * sizeY;
+    head.fileSize = sizeof(head) + sizeof(info) + (sizeX * 3 + padding) * sizeY + 2;
     head.offset = sizeof(head) + sizeof(info) + 2;
     out.write((char*)(&head), sizeof(head));
 
@@ -68,9 +69,9 @@ bool Bitmap::SaveBMP(const std::string& filename)
             out.write((char*)&c.b, sizeof(c.b));
             out.write((char*)&c.g, sizeof(c.g));
             out.write((char*)&c.r, sizeof(c.r));
-            for(int i=0; i < padding; i++)
-                out.put('\0');
         }
+        for(int i=0; i < padding; i++)
+            out.put('\0');
     }
     return true;
 }
@@ -82,6 +83,11 @@ bool Bitmap::LoadPNG(const std::string& filename)
     png_byte bit_depth;
     png_bytep *row_pointers = NULL;
     FILE *fp = fopen(filename.c_str(), "rb");
+    if(!fp)
+    {
+        std::cout <<"Failed to open png file " <<filename<<"\n";
+        return false;
+    }
 
     png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if(!png) abort();
@@ -149,6 +155,164 @@ bool Bitmap::LoadPNG(const std::string& filename)
 
 }
 
+bool Bitmap::StreamFromFile(const std::string& filename, const HeaderCallback& onHeader, const RowCallback& onRow)
+{
+    if(std::filesystem::path(filename).extension() == ".bmp")
+        return StreamBMP(filename, onHeader, onRow);
+    else
+    if(std::filesystem::path(filename).extension() == ".png")
+        return StreamPNG(filename, onHeader, onRow);
+    std::cout <<"Unsuported format: "<<std::filesystem::path(filename).extension()<<"\n";
+    return false;
+}
+
+bool Bitmap::StreamBMP(const std::string& filename, const HeaderCallback& onHeader, const RowCallback& onRow)
+{
+    std::ifstream in(filename.c_str(), std::ifstream::in | std::ifstream::binary);
+    if(!in.is_open())
+    {
+        std::cout <<"Failed to read bitmap file " <<filename<<"\n";
+        return false;
+    }
+    if(in.get() != 'B' || in.get() != 'M')
+    {
+        std::cout <<"Bitmap header invalid " <<filename<<"\n";
+        return false;
+    }
+    Header head;
+    InfoHeader info;
+    in.read((char*)&head, sizeof(head));
+    in.read((char*)&info, sizeof(info));
+
+    if(info.bitsPerPixel != 24 || info.compression)
+    {
+        std::cout <<"Error: Invalid format. Only supports 24 bit bitmaps with no compression\n";
+        return false;
+    }
+
+    //a negative height marks a top-down bitmap, the default is bottom-up
+    int32_t height = static_cast<int32_t>(info.height);
+    bool topDown = height < 0;
+    uint32_t width = info.width;
+    uint32_t rows = topDown ? static_cast<uint32_t>(-static_cast<int64_t>(height)) : static_cast<uint32_t>(height);
+    if(!onHeader(width, rows, false))
+        return false;
+
+    size_t stride = (static_cast<size_t>(width) * 3 + 3) & ~static_cast<size_t>(3);
+    std::vector<uint8_t> scanline(stride);
+    std::vector<uint8_t> rgba(static_cast<size_t>(width) * 4);
+
+    for(uint32_t y = 0; y < rows; y++)
+    {
+        uint32_t fileRow = topDown ? y : rows - 1 - y;
+        in.seekg(head.offset + fileRow * static_cast<std::streamoff>(stride));
+        in.read((char*)scanline.data(), stride);
+        if(!in.good())
+            return false;
+
+        for(uint32_t x = 0; x < width; x++)
+        {
+            rgba[x * 4] = scanline[x * 3 + 2];
+            rgba[x * 4 + 1] = scanline[x * 3 + 1];
+            rgba[x * 4 + 2] = scanline[x * 3];
+            rgba[x * 4 + 3] = 255;
+        }
+        if(!onRow(rgba.data()))
+            return false;
+    }
+    return true;
+}
+
+bool Bitmap::StreamPNG(const std::string& filename, const HeaderCallback& onHeader, const RowCallback& onRow)
+{
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if(!fp)
+    {
+        std::cout <<"Failed to open png file " <<filename<<"\n";
+        return false;
+    }
+
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    if(!png || !info)
+    {
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(fp);
+        return false;
+    }
+
+    //the row lives on the heap so it survives a longjmp from libpng unchanged
+    std::unique_ptr<std::vector<png_byte>> row(new std::vector<png_byte>());
+
+    if(setjmp(png_jmpbuf(png)))
+    {
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(fp);
+        return false;
+    }
+
+    png_init_io(png, fp);
+    png_read_info(png, info);
+
+    if(png_get_interlace_type(png, info) != PNG_INTERLACE_NONE)
+    {
+        //interlaced images can't be read row by row, load them as a whole instead
+        png_destroy_read_struct(&png, &info, NULL);
+        fclose(fp);
+
+        Bitmap bmp;
+        if(!bmp.LoadPNG(filename))
+            return false;
+        std::vector<uint8_t> rgba;
+        bmp.GetRaw(rgba);
+        bool hasAlpha = false;
+        for(size_t i = 3; i < rgba.size() && !hasAlpha; i += 4)
+            hasAlpha = rgba[i] != 255;
+        if(!onHeader(bmp.GetWidth(), bmp.GetHeight(), hasAlpha))
+            return false;
+        for(size_t y = 0; y < bmp.GetHeight(); y++)
+            if(!onRow(rgba.data() + y * bmp.GetWidth() * 4))
+                return false;
+        return true;
+    }
+
+    uint32_t width = png_get_image_width(png, info);
+    uint32_t height = png_get_image_height(png, info);
+    png_byte color_type = png_get_color_type(png, info);
+    png_byte bit_depth = png_get_bit_depth(png, info);
+    bool hasAlpha = (color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS);
+
+    if(bit_depth == 16)
+        png_set_strip_16(png);
+    if(color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png);
+    if(color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+        png_set_expand_gray_1_2_4_to_8(png);
+    if(png_get_valid(png, info, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(png);
+    if(color_type == PNG_COLOR_TYPE_RGB ||
+        color_type == PNG_COLOR_TYPE_GRAY ||
+        color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    if(color_type == PNG_COLOR_TYPE_GRAY ||
+        color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+        png_set_gray_to_rgb(png);
+
+    png_read_update_info(png, info);
+    row->resize(png_get_rowbytes(png, info));
+
+    bool success = onHeader(width, height, hasAlpha);
+    for(uint32_t y = 0; success && y < height; y++)
+    {
+        png_read_row(png, row->data(), NULL);
+        success = onRow(row->data());
+    }
+
+    png_destroy_read_struct(&png, &info, NULL);
+    fclose(fp);
+    return success;
+}
+
 bool Bitmap::LoadBMP(const std::string& filename)
 {
     std::ifstream in(filename.c_str(), std::ifstream::in | std::ifstream::binary);
@@ -180,6 +344,7 @@ bool Bitmap::LoadBMP(const std::string& filename)
     }
 
     Create(info.width, info.height);
+    in.seekg(head.offset);
 
     int padding = (4 - ((sizeX * 3) % 4) ) % 4;
 
@@ -193,9 +358,9 @@ bool Bitmap::LoadBMP(const std::string& filename)
             in.read((char*)&c.r, sizeof(c.r));
             c.a = 255;
             SetPixel(x,y, c);
-            for(int i=0; i < padding; i++)
-                in.get();
         }
+        for(int i=0; i < padding; i++)
+            in.get();
     }
     return true;
 }
@@ -335,10 +500,10 @@ void Bitmap::GetRaw(std::vector<uint8_t>& rgba)
 {
     rgba.resize(colorData.size() * 4);
     size_t i = 0;
-    for(size_t y = 1; y < sizeY; y++)
+    for(size_t y = 0; y < sizeY; y++)
         for(size_t x = 0; x < sizeX; x++)
         {
-            Color color = GetPixel(x, sizeY - y);
+            Color color = GetPixel(x, sizeY - 1 - y);
             rgba[i++] = color.r;
             rgba[i++] = color.g;
             rgba[i++] = color.b;
@@ -346,7 +511,7 @@ void Bitmap::GetRaw(std::vector<uint8_t>& rgba)
         }
 }
 
-void Bitmap::SetRaw(std::vector<uint8_t>& rgba, size_t w, size_t h)
+void Bitmap::SetRaw(std::vector<uint8_t>& rgba, size_t w, size_t h, size_t channels)
 {
     sizeX = w;
     sizeY = h;
@@ -354,14 +519,14 @@ void Bitmap::SetRaw(std::vector<uint8_t>& rgba, size_t w, size_t h)
     colorData.resize(w * h);
 
     size_t i = 0;
-    for(size_t y = 1; y < sizeY; y++)
+    for(size_t y = 0; y < sizeY; y++)
         for(size_t x = 0; x < sizeX; x++)
         {
             Color color;
             color.r = rgba[i++];
-            color.r = rgba[i++];
-            color.r = rgba[i++];
-            color.a = rgba[i++];
-            SetPixel(x,y,color);
+            color.g = rgba[i++];
+            color.b = rgba[i++];
+            color.a = channels == 4 ? rgba[i++] : 255;
+            SetPixel(x, sizeY - 1 - y, color);
         }
 }
@@ -1,6 +1,8 @@
 #ifndef BITMAP_H_INCLUDED
 #define BITMAP_H_INCLUDED
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -35,6 +37,9 @@ public:
         uint8_t r,g,b,a;    //alpha is added anyways size wise in the form of byte padding
     };
 
+    typedef std::function<bool(uint32_t width, uint32_t height, bool hasAlpha)> HeaderCallback;
+    typedef std::function<bool(const uint8_t* rgba)> RowCallback;
+
     Bitmap();
     Bitmap(const std::string& filename);
     Bitmap(size_t x, size_t y);
@@ -51,6 +56,16 @@ public:
     bool LoadBMP(const std::string& filename);
     bool LoadPNG(const std::string& filename);
 
+    /**
+      * Reads an image row by row without loading it as a whole.
+      * onHeader receives the image size and whether the source can hold alpha other than 255,
+      * then onRow receives every row top-down as RGBA.
+      * Returning false from a callback aborts reading.
+      */
+    static bool StreamFromFile(const std::string& filename, const HeaderCallback& onHeader, const RowCallback& onRow);
+    static bool StreamBMP(const std::string& filename, const HeaderCallback& onHeader, const RowCallback& onRow);
+    static bool StreamPNG(const std::string& filename, const HeaderCallback& onHeader, const RowCallback& onRow);
+
     Color GetPixel(uint32_t x, uint32_t y);
     void SetPixel(uint32_t x, uint32_t y, uint8_t r, uint8_t g, uint8_t b, uint8_t a = 0xff);
     void SetPixel(uint32_t x, uint32_t y, Color c);
@@ -59,7 +74,7 @@ public:
     void Clear(Color c);
 
     void GetRaw(std::vector<uint8_t>& rgba);
-    void SetRaw(std::vector<uint8_t>& rgba, size_t w, size_t h);
+    void SetRaw(std::vector<uint8_t>& rgba, size_t w, size_t h, size_t channels = 4);
 
     size_t GetWidth(void) const
     {
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <cppqoi.hpp>
 #include "Bitmap.h"
+#include "Batch.h"
 
 int main(int argc, char* argv[])
 {
@@ -12,8 +13,12 @@ int main(int argc, char* argv[])
     {
         std::cout <<"Error: missing arguments...\n";
         std::cout <<"Usage is QOIBMP e/d sourceFile destFile\n";
+        std::cout <<"      or QOIBMP b sourceDir destDir [threads]\n";
+        std::cout <<"      or QOIBMP l sourceDir queueDepth\n";
         std::cout <<"e: encode mode\n";
         std::cout <<"d: decode mode\n";
+        std::cout <<"b: batch mode, converts a directory tree bmp/png <-> qoi\n";
+        std::cout <<"l: load mode, times batch loading every qoi file of a directory tree\n";
         //return 0;
         mode = "d";
         inputFile = "output.qoi";
@@ -29,16 +34,11 @@ int main(int argc, char* argv[])
     if(mode == "e")
     {
         std::cout <<"Encoding " << inputFile <<" to " <<outputFile <<" in the qoi format\n";
-        Bitmap bmp;
-        if(!bmp.LoadFromFile(inputFile))
+        if(!EncodeToQoi(inputFile, outputFile))
         {
-            std::cout <<"Failed to load " <<inputFile <<"\n";
+            std::cout <<"Failed to encode " <<inputFile <<"\n";
             return 0;
         }
-
-        std::vector<uint8_t> rgba;
-        bmp.GetRaw(rgba);
-        cppqoi::WriteQoi(outputFile, {rgba, (uint32_t)bmp.GetWidth(), (uint32_t)bmp.GetHeight(), 4, 1});
     }
     else
     if(mode == "d")
@@ -50,12 +50,46 @@ int main(int argc, char* argv[])
             std::cout <<"Failed to load " <<inputFile <<"\n";
             return 0;
         }
-        cppqoi::WriteQoi("out.qoi", qoi);
 
         std::cout <<"Read image with size " <<qoi.width <<" x " <<qoi.height<<"\n";
         Bitmap bitmap;
-        bitmap.SetRaw(qoi.pixelData, qoi.width, qoi.height);
+        bitmap.SetRaw(qoi.pixelData, qoi.width, qoi.height, qoi.channels);
         bitmap.SaveToFile(outputFile);
     }
+    else
+    if(mode == "b")
+    {
+        unsigned threads = argc > 4 ? static_cast<unsigned>(std::stoul(argv[4])) : 0;
+        std::cout <<"Converting " <<inputFile <<" to " <<outputFile <<"\n";
+        BatchStats stats;
+        ConvertDirectory(inputFile, outputFile, threads, stats);
+        PrintBatchStats(stats);
+    }
+    else
+    if(mode == "l")
+    {
+        std::vector<std::string> filenames;
+        for(const auto& entry : std::filesystem::recursive_directory_iterator(inputFile))
+            if(entry.is_regular_file() && entry.path().extension() == ".qoi")
+                filenames.push_back(entry.path().string());
+
+        cppqoi::QoiBatchIO io(static_cast<unsigned>(std::stoul(outputFile)));
+        for(int pass = 0; pass < 2; pass++)
+        {
+            if(pass == 1)
+            {
+                if(!io.UsesIoUring())
+                    break;
+                io.DisableIoUring();
+            }
+            std::vector<cppqoi::QoiFile> files;
+            std::vector<bool> success;
+            io.Load(filenames, files, success);
+            const cppqoi::QoiBatchStats& stats = io.GetStats();
+            std::cout <<(io.UsesIoUring() ? "io_uring: " : "thread pool: ") <<stats.files <<" files loaded, "
+                      <<stats.failed <<" failed in " <<stats.seconds <<"s, " <<stats.FilesPerSecond() <<" files/s, "
+                      <<stats.MegabytesPerSecond() <<" MB/s, " <<(stats.seconds > 0.0 ? stats.pixels / stats.seconds / 1e6 : 0.0) <<" MP/s\n";
+        }
+    }
     return 0;
 }